@@ -0,0 +1,50 @@
+#include "CountingMatAllocator.h"
+#include <mutex>
+
+namespace
+{
+	// constant-initialized, so it is safe to touch from operator new at any time in the life of a thread.
+	thread_local size_t ThreadAllocationNum = 0;
+}
+
+cv::UMatData* CountingMatAllocator::allocate(
+	int dims,
+	const int* sizes,
+	int type,
+	void* data,
+	size_t* step,
+	cv::AccessFlag flags,
+	cv::UMatUsageFlags usage_flags
+) const
+{
+	if (data == nullptr) ThreadAllocationNum++;
+	return cv::Mat::getStdAllocator()->allocate( dims, sizes, type, data, step, flags, usage_flags );
+}
+
+bool CountingMatAllocator::allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const
+{
+	return cv::Mat::getStdAllocator()->allocate( data, access_flags, usage_flags );
+}
+
+void CountingMatAllocator::deallocate(cv::UMatData* data) const
+{
+	cv::Mat::getStdAllocator()->deallocate( data );
+}
+
+void CountingMatAllocator::install()
+{
+	// never destroyed, since static mats may release their buffers through it after the end of main.
+	static const auto* allocator = new CountingMatAllocator();
+	static std::once_flag is_installed;
+	std::call_once( is_installed, []() { cv::Mat::setDefaultAllocator( const_cast<CountingMatAllocator*>(allocator) ); } );
+}
+
+size_t CountingMatAllocator::getThreadAllocationNum()
+{
+	return ThreadAllocationNum;
+}
+
+void CountingMatAllocator::countAllocation()
+{
+	ThreadAllocationNum++;
+}
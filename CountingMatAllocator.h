@@ -0,0 +1,37 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// Counts the heap allocations of the calling thread, to check that per-frame work reuses its buffers. Nothing is
+// counted until a program opts in: install() makes it the default cv::Mat allocator of the process, forwarding to
+// the standard one, so every new cv::Mat buffer is seen, including the temporaries and outputs created inside OpenCV
+// functions, and a program that also links CountingOperatorNew.cpp (the benchmark, built with
+// VIDEOSTAB_COUNT_ALLOCATIONS) counts every operator new as well. The counts are per thread, so concurrent
+// stabilizers do not see each other, but allocations that OpenCV makes on its parallel_for_ worker threads are not
+// seen by the calling thread.
+class CountingMatAllocator final : public cv::MatAllocator
+{
+public:
+	CountingMatAllocator() = default;
+	~CountingMatAllocator() override = default;
+
+	cv::UMatData* allocate(
+		int dims,
+		const int* sizes,
+		int type,
+		void* data,
+		size_t* step,
+		cv::AccessFlag flags,
+		cv::UMatUsageFlags usage_flags
+	) const override;
+	bool allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override;
+	void deallocate(cv::UMatData* data) const override;
+
+	// idempotent and thread-safe. the allocator is never uninstalled, since buffers allocated through it may outlive
+	// any scope that would restore the previous one.
+	static void install();
+
+	// cv::Mat buffers and operator new calls made by the calling thread so far.
+	[[nodiscard]] static size_t getThreadAllocationNum();
+	static void countAllocation();
+};
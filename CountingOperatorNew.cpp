@@ -0,0 +1,38 @@
+#include "CountingMatAllocator.h"
+#include <cstdlib>
+#include <new>
+
+// replaces the global operator new and delete of the program it is linked into, so that CountingMatAllocator also
+// counts C++ allocations. only the benchmark links it, since a library must not take over the global allocation.
+void* operator new(std::size_t size)
+{
+	CountingMatAllocator::countAllocation();
+	void* data = std::malloc( size == 0 ? 1 : size );
+	if (data == nullptr) throw std::bad_alloc();
+	return data;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new( size );
+}
+
+void operator delete(void* data) noexcept
+{
+	std::free( data );
+}
+
+void operator delete[](void* data) noexcept
+{
+	std::free( data );
+}
+
+void operator delete(void* data, std::size_t) noexcept
+{
+	std::free( data );
+}
+
+void operator delete[](void* data, std::size_t) noexcept
+{
+	std::free( data );
+}
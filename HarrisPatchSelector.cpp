@@ -0,0 +1,400 @@
+#include "HarrisPatchSelector.h"
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+	constexpr int RowCacheSize = 8;
+
+	// the fixed-point kernel, in 1/256, that the 8-bit GaussianBlur derives for 5x5 and sigma 1. the image is
+	// blurred with it in integers and rounded the same way, so the blurred image is bit-exact with that of OpenCV.
+	constexpr int ImageKernel[5] = { 14, 62, 104, 62, 14 };
+	constexpr int ImageKernelBits = 8;
+	static_assert( ImageKernel[0] == ImageKernel[4] && ImageKernel[1] == ImageKernel[3], "the vector paths pair the symmetric taps" );
+
+	int reflect101(int p, int size)
+	{
+		if (p < 0) return -p;
+		if (p >= size) return 2 * size - p - 2;
+		return p;
+	}
+
+	void getGaussianKernel(float* kernel, double sigma)
+	{
+		double sum = 0.0;
+		double weights[5];
+		for (int i = 0; i < 5; ++i) {
+			weights[i] = std::exp( -(i - 2) * (i - 2) / (2.0 * sigma * sigma) );
+			sum += weights[i];
+		}
+		for (int i = 0; i < 5; ++i) kernel[i] = static_cast<float>(weights[i] / sum);
+	}
+
+	// dst[i] = sum_k kernel[k] * rows[k][i]
+	void convolveVertical(float* dst, const float* const* rows, const float* kernel, int n)
+	{
+		int i = 0;
+#if CV_SIMD
+		const cv::v_float32 k0 = cv::vx_setall_f32( kernel[0] ), k1 = cv::vx_setall_f32( kernel[1] );
+		const cv::v_float32 k2 = cv::vx_setall_f32( kernel[2] ), k3 = cv::vx_setall_f32( kernel[3] );
+		const cv::v_float32 k4 = cv::vx_setall_f32( kernel[4] );
+		for (; i <= n - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+			cv::v_float32 sum = cv::vx_load( rows[0] + i ) * k0;
+			sum = cv::v_muladd( cv::vx_load( rows[1] + i ), k1, sum );
+			sum = cv::v_muladd( cv::vx_load( rows[2] + i ), k2, sum );
+			sum = cv::v_muladd( cv::vx_load( rows[3] + i ), k3, sum );
+			sum = cv::v_muladd( cv::vx_load( rows[4] + i ), k4, sum );
+			cv::v_store( dst + i, sum );
+		}
+#endif
+		for (; i < n; ++i) {
+			dst[i] =
+				kernel[0] * rows[0][i] + kernel[1] * rows[1][i] + kernel[2] * rows[2][i] +
+				kernel[3] * rows[3][i] + kernel[4] * rows[4][i];
+		}
+	}
+
+	// dst[i] = sum_k ImageKernel[k] * rows[k][i], exact in 16 bits since the kernel sums to 256.
+	void convolveVertical(int* dst, const uchar* const* rows, int n)
+	{
+		int i = 0;
+#if CV_SIMD
+		const cv::v_uint16 k0 = cv::vx_setall_u16( ImageKernel[0] ), k1 = cv::vx_setall_u16( ImageKernel[1] );
+		const cv::v_uint16 k2 = cv::vx_setall_u16( ImageKernel[2] );
+		for (; i <= n - cv::v_uint16::nlanes; i += cv::v_uint16::nlanes) {
+			cv::v_uint16 sum = (cv::vx_load_expand( rows[0] + i ) + cv::vx_load_expand( rows[4] + i )) * k0;
+			sum += (cv::vx_load_expand( rows[1] + i ) + cv::vx_load_expand( rows[3] + i )) * k1;
+			sum += cv::vx_load_expand( rows[2] + i ) * k2;
+			cv::v_uint32 low, high;
+			cv::v_expand( sum, low, high );
+			cv::v_store( dst + i, cv::v_reinterpret_as_s32( low ) );
+			cv::v_store( dst + i + cv::v_uint32::nlanes, cv::v_reinterpret_as_s32( high ) );
+		}
+#endif
+		for (; i < n; ++i) {
+			dst[i] =
+				ImageKernel[0] * rows[0][i] + ImageKernel[1] * rows[1][i] + ImageKernel[2] * rows[2][i] +
+				ImageKernel[3] * rows[3][i] + ImageKernel[4] * rows[4][i];
+		}
+	}
+
+	// dst[i] = round(sum_k ImageKernel[k] * src[i + k] / 2^16), the rounding of the 8-bit output of GaussianBlur.
+	void blurHorizontal(float* dst, const int* src, int n)
+	{
+		constexpr int shift = 2 * ImageKernelBits;
+		int i = 0;
+#if CV_SIMD
+		const cv::v_int32 k0 = cv::vx_setall_s32( ImageKernel[0] ), k1 = cv::vx_setall_s32( ImageKernel[1] );
+		const cv::v_int32 k2 = cv::vx_setall_s32( ImageKernel[2] );
+		const cv::v_int32 round = cv::vx_setall_s32( 1 << (shift - 1) );
+		for (; i <= n - cv::v_int32::nlanes; i += cv::v_int32::nlanes) {
+			cv::v_int32 sum = (cv::vx_load( src + i ) + cv::vx_load( src + i + 4 )) * k0 + round;
+			sum += (cv::vx_load( src + i + 1 ) + cv::vx_load( src + i + 3 )) * k1;
+			sum += cv::vx_load( src + i + 2 ) * k2;
+			cv::v_store( dst + i, cv::v_cvt_f32( sum >> shift ) );
+		}
+#endif
+		for (; i < n; ++i) {
+			const int sum =
+				ImageKernel[0] * src[i] + ImageKernel[1] * src[i + 1] + ImageKernel[2] * src[i + 2] +
+				ImageKernel[3] * src[i + 3] + ImageKernel[4] * src[i + 4];
+			dst[i] = static_cast<float>((sum + (1 << (shift - 1))) >> shift);
+		}
+	}
+
+	// dst[i] = sum_k kernel[k] * src[i + k]
+	void convolveHorizontal(float* dst, const float* src, const float* kernel, int n)
+	{
+		const float* rows[5] = { src, src + 1, src + 2, src + 3, src + 4 };
+		convolveVertical( dst, rows, kernel, n );
+	}
+
+	// Streams the structure tensor of one band row by row. Every stage keeps only the few rows its successor
+	// still needs, and every row covers the band columns plus the halo of the later stages.
+	// Borders are reflected at each stage like cv::BORDER_REFLECT_101, which is the default of the separate filters.
+	class TensorStream
+	{
+	public:
+		TensorStream(const cv::Mat& gray_frame, const cv::Rect& region, const float* tensor_kernel) :
+			Gray( gray_frame ), TensorKernel( tensor_kernel ),
+			TensorBegin( region.x ), TensorEnd( region.br().x )
+		{
+			ProductBegin = std::max( TensorBegin - 2, 0 );
+			ProductEnd = std::min( TensorEnd + 2, Gray.cols );
+			ProductOrigin = TensorBegin - 2;
+			ProductWidth = TensorEnd - TensorBegin + 4;
+
+			BlurredBegin = std::max( ProductBegin - 1, 0 );
+			BlurredEnd = std::min( ProductEnd + 1, Gray.cols );
+			BlurredOrigin = ProductBegin - 1;
+			BlurredWidth = ProductEnd - ProductBegin + 2;
+
+			SourceBegin = BlurredBegin - 2;
+			SourceWidth = BlurredEnd - BlurredBegin + 4;
+
+			std::fill( BlurredRows, BlurredRows + RowCacheSize, INT_MIN );
+			std::fill( ProductRows, ProductRows + RowCacheSize, INT_MIN );
+			BlurredCache.resize( RowCacheSize * BlurredWidth );
+			ProductCache.resize( RowCacheSize * ProductWidth * 3 );
+			SourceBuffer.resize( SourceWidth );
+			VerticalBuffer.resize( ProductWidth * 3 );
+			Tensor.resize( (TensorEnd - TensorBegin) * 3 );
+		}
+
+		// computes the smoothed IxIx, IxIy and IyIy of the row y for the band columns.
+		void computeTensorRow(int y)
+		{
+			const int tensor_width = TensorEnd - TensorBegin;
+			const float* products[5];
+			for (int k = 0; k < 5; ++k) products[k] = getProductRow( reflect101( y + k - 2, Gray.rows ) );
+
+			for (int channel = 0; channel < 3; ++channel) {
+				const float* rows[5];
+				for (int k = 0; k < 5; ++k) rows[k] = products[k] + channel * ProductWidth;
+				float* vertical = VerticalBuffer.data() + channel * ProductWidth;
+				convolveVertical( vertical, rows, TensorKernel, ProductWidth );
+				convolveHorizontal( Tensor.data() + channel * tensor_width, vertical, TensorKernel, tensor_width );
+			}
+		}
+
+		[[nodiscard]] const float* getIxIx() const { return Tensor.data(); }
+		[[nodiscard]] const float* getIxIy() const { return Tensor.data() + (TensorEnd - TensorBegin); }
+		[[nodiscard]] const float* getIyIy() const { return Tensor.data() + 2 * (TensorEnd - TensorBegin); }
+
+	private:
+		const cv::Mat& Gray;
+		const float* TensorKernel;
+		int TensorBegin, TensorEnd;
+		int ProductBegin, ProductEnd, ProductOrigin, ProductWidth;
+		int BlurredBegin, BlurredEnd, BlurredOrigin, BlurredWidth;
+		int SourceBegin, SourceWidth;
+		int BlurredRows[RowCacheSize];
+		int ProductRows[RowCacheSize];
+		std::vector<float> BlurredCache;
+		std::vector<float> ProductCache;
+		std::vector<int> SourceBuffer;
+		std::vector<float> VerticalBuffer;
+		std::vector<float> Tensor;
+
+		// fills the columns of a row buffer that lie outside of the image with their reflection.
+		template<typename T>
+		void reflectBorder(T* row, int origin, int width, int begin, int end) const
+		{
+			for (int x = origin; x < begin; ++x) {
+				if (x < 0) row[x - origin] = row[reflect101( x, Gray.cols ) - origin];
+			}
+			for (int x = end; x < origin + width; ++x) {
+				if (x >= Gray.cols) row[x - origin] = row[reflect101( x, Gray.cols ) - origin];
+			}
+		}
+
+		const float* getBlurredRow(int y)
+		{
+			float* blurred = BlurredCache.data() + (y & (RowCacheSize - 1)) * BlurredWidth;
+			if (BlurredRows[y & (RowCacheSize - 1)] == y) return blurred;
+			BlurredRows[y & (RowCacheSize - 1)] = y;
+
+			const uchar* rows[5];
+			for (int k = 0; k < 5; ++k) rows[k] = Gray.ptr<uchar>( reflect101( y + k - 2, Gray.rows ) );
+
+			int* source = SourceBuffer.data();
+			const int inner_begin = std::max( SourceBegin, 0 );
+			const int inner_end = std::min( SourceBegin + SourceWidth, Gray.cols );
+			const uchar* shifted[5];
+			for (int k = 0; k < 5; ++k) shifted[k] = rows[k] + inner_begin;
+			convolveVertical( source + inner_begin - SourceBegin, shifted, inner_end - inner_begin );
+			reflectBorder( source, SourceBegin, SourceWidth, inner_begin, inner_end );
+
+			// the blurred image holds the 8-bit values of GaussianBlur before the derivatives are taken.
+			blurHorizontal( blurred + BlurredBegin - BlurredOrigin, source + BlurredBegin - 2 - SourceBegin, BlurredEnd - BlurredBegin );
+			reflectBorder( blurred, BlurredOrigin, BlurredWidth, BlurredBegin, BlurredEnd );
+			return blurred;
+		}
+
+		const float* getProductRow(int y)
+		{
+			float* products = ProductCache.data() + (y & (RowCacheSize - 1)) * ProductWidth * 3;
+			if (ProductRows[y & (RowCacheSize - 1)] == y) return products;
+			ProductRows[y & (RowCacheSize - 1)] = y;
+
+			const float* upper = getBlurredRow( reflect101( y - 1, Gray.rows ) ) + ProductBegin - BlurredOrigin;
+			const float* middle = getBlurredRow( y ) + ProductBegin - BlurredOrigin;
+			const float* lower = getBlurredRow( reflect101( y + 1, Gray.rows ) ) + ProductBegin - BlurredOrigin;
+			float* ixix = products;
+			float* ixiy = products + ProductWidth;
+			float* iyiy = products + 2 * ProductWidth;
+			const int offset = ProductBegin - ProductOrigin;
+			const int width = ProductEnd - ProductBegin;
+			int x = 0;
+#if CV_SIMD
+			const cv::v_float32 two = cv::vx_setall_f32( 2.0f );
+			for (; x <= width - cv::v_float32::nlanes; x += cv::v_float32::nlanes) {
+				const cv::v_float32 ul = cv::vx_load( upper + x - 1 ), uc = cv::vx_load( upper + x ), ur = cv::vx_load( upper + x + 1 );
+				const cv::v_float32 ml = cv::vx_load( middle + x - 1 ), mr = cv::vx_load( middle + x + 1 );
+				const cv::v_float32 ll = cv::vx_load( lower + x - 1 ), lc = cv::vx_load( lower + x ), lr = cv::vx_load( lower + x + 1 );
+				const cv::v_float32 dx = cv::v_muladd( mr - ml, two, (ur - ul) + (lr - ll) );
+				const cv::v_float32 dy = cv::v_muladd( lc - uc, two, (ll - ul) + (lr - ur) );
+				cv::v_store( ixix + offset + x, dx * dx );
+				cv::v_store( ixiy + offset + x, dx * dy );
+				cv::v_store( iyiy + offset + x, dy * dy );
+			}
+#endif
+			for (; x < width; ++x) {
+				const float dx = (upper[x + 1] - upper[x - 1]) + 2.0f * (middle[x + 1] - middle[x - 1]) + (lower[x + 1] - lower[x - 1]);
+				const float dy = (lower[x - 1] - upper[x - 1]) + 2.0f * (lower[x] - upper[x]) + (lower[x + 1] - upper[x + 1]);
+				ixix[offset + x] = dx * dx;
+				ixiy[offset + x] = dx * dy;
+				iyiy[offset + x] = dy * dy;
+			}
+			reflectBorder( ixix, ProductOrigin, ProductWidth, ProductBegin, ProductEnd );
+			reflectBorder( ixiy, ProductOrigin, ProductWidth, ProductBegin, ProductEnd );
+			reflectBorder( iyiy, ProductOrigin, ProductWidth, ProductBegin, ProductEnd );
+			return products;
+		}
+	};
+}
+
+HarrisPatchSelector::HarrisPatchSelector() : TensorKernel{}
+{
+	getGaussianKernel( TensorKernel, 2.0 );
+}
+
+void HarrisPatchSelector::getBands(std::vector<Band>& bands, const std::vector<cv::Rect>& patches)
+{
+	std::vector<int> indices(patches.size());
+	for (size_t i = 0; i < patches.size(); ++i) indices[i] = static_cast<int>(i);
+	std::sort(
+		indices.begin(), indices.end(),
+		[&patches](int a, int b) {
+			const cv::Rect& p = patches[a];
+			const cv::Rect& q = patches[b];
+			if (p.y != q.y) return p.y < q.y;
+			if (p.height != q.height) return p.height < q.height;
+			return p.x < q.x;
+		}
+	);
+
+	// horizontally adjacent patches of the same rows share one band, so their halos are computed only once.
+	bands.clear();
+	for (const auto& index : indices) {
+		const cv::Rect& patch = patches[index];
+		if (patch.empty()) continue;
+		if (!bands.empty()) {
+			cv::Rect& region = bands.back().Region;
+			if (region.y == patch.y && region.height == patch.height && region.br().x == patch.x) {
+				region.width += patch.width;
+				bands.back().PatchIndices.emplace_back( index );
+				continue;
+			}
+		}
+		bands.push_back( { patch, { index } } );
+	}
+}
+
+void HarrisPatchSelector::insertCandidate(std::vector<Candidate>& candidates, const Candidate& candidate, int points_per_patch, int spacing)
+{
+	// a candidate is suppressed by a stronger one within the spacing, and suppresses the weaker ones itself.
+	auto is_near = [spacing, &candidate](const Candidate& other) {
+		return
+			std::abs( other.X - candidate.X ) < spacing &&
+			std::abs( other.Y - candidate.Y ) < spacing;
+	};
+	for (const auto& other : candidates) {
+		if (other.Trace >= candidate.Trace && is_near( other )) return;
+	}
+	candidates.erase( std::remove_if( candidates.begin(), candidates.end(), is_near ), candidates.end() );
+
+	const auto position = std::find_if(
+		candidates.begin(), candidates.end(), [&candidate](const Candidate& other) { return other.Trace < candidate.Trace; }
+	);
+	candidates.insert( position, candidate );
+	if (static_cast<int>(candidates.size()) > points_per_patch) candidates.pop_back();
+}
+
+void HarrisPatchSelector::processBand(
+	std::vector<HarrisPoint>& selected,
+	const Band& band,
+	const cv::Mat& gray_frame,
+	const std::vector<cv::Rect>& patches,
+	int points_per_patch
+) const
+{
+	TensorStream stream(gray_frame, band.Region, TensorKernel);
+	std::vector<std::vector<Candidate>> candidates(band.PatchIndices.size());
+	std::vector<int> spacings(band.PatchIndices.size());
+	const int grid_size = static_cast<int>(std::ceil( std::sqrt( static_cast<double>(points_per_patch) ) ));
+	for (size_t p = 0; p < band.PatchIndices.size(); ++p) {
+		const cv::Rect& patch = patches[band.PatchIndices[p]];
+		candidates[p].reserve( points_per_patch + 1 );
+		spacings[p] = std::max( std::min( patch.width, patch.height ) / (2 * grid_size), 1 );
+	}
+
+	for (int y = band.Region.y; y < band.Region.br().y; ++y) {
+		stream.computeTensorRow( y );
+		const float* ixix = stream.getIxIx();
+		const float* ixiy = stream.getIxIy();
+		const float* iyiy = stream.getIyIy();
+		for (size_t p = 0; p < band.PatchIndices.size(); ++p) {
+			const cv::Rect& patch = patches[band.PatchIndices[p]];
+			const int begin = patch.x - band.Region.x;
+			const int end = begin + patch.width;
+			std::vector<Candidate>& patch_candidates = candidates[p];
+			for (int x = begin; x < end; ++x) {
+				const float trace = ixix[x] + iyiy[x];
+				const bool is_full = static_cast<int>(patch_candidates.size()) == points_per_patch;
+				if (trace <= (is_full ? patch_candidates.back().Trace : -1.0f)) continue;
+
+				insertCandidate( patch_candidates, { trace, ixix[x], ixiy[x], iyiy[x], band.Region.x + x, y }, points_per_patch, spacings[p] );
+			}
+		}
+	}
+
+	for (size_t p = 0; p < band.PatchIndices.size(); ++p) {
+		const std::vector<Candidate>& patch_candidates = candidates[p];
+		const int candidate_num = static_cast<int>(patch_candidates.size());
+		for (int k = 0; k < points_per_patch; ++k) {
+			HarrisPoint& point = selected[band.PatchIndices[p] * points_per_patch + k];
+			if (k >= candidate_num) {
+				// the slot keeps the place of the strongest point, so the trackers still get a position, but it never
+				// counts in the estimation. its eigenvalue is 1 only so that the weighted error stays finite.
+				const cv::Rect& patch = patches[band.PatchIndices[p]];
+				point.HarrisMatrix = cv::Matx<float, 2, 2>::zeros();
+				point.Point = candidate_num > 0 ?
+					cv::Point2f(static_cast<float>(patch_candidates[0].X), static_cast<float>(patch_candidates[0].Y)) :
+					cv::Point2f(static_cast<float>(patch.x), static_cast<float>(patch.y));
+				point.MaxEigenvalue = 1.0f;
+				point.IsSelected = false;
+				continue;
+			}
+
+			const Candidate& candidate = patch_candidates[k];
+			point.HarrisMatrix = cv::Matx<float, 2, 2>(candidate.IxIx, candidate.IxIy, candidate.IxIy, candidate.IyIy);
+			point.Point = cv::Point2f(static_cast<float>(candidate.X), static_cast<float>(candidate.Y));
+			const float t = (candidate.IxIx - candidate.IyIy) * (candidate.IxIx - candidate.IyIy) + 4.0f * candidate.IxIy * candidate.IxIy;
+			point.MaxEigenvalue = 0.5f * (candidate.Trace + std::sqrt( t ));
+			point.IsSelected = true;
+		}
+	}
+}
+
+void HarrisPatchSelector::select(
+	std::vector<HarrisPoint>& selected,
+	const cv::Mat& gray_frame,
+	const std::vector<cv::Rect>& patches,
+	int points_per_patch
+) const
+{
+	CV_Assert( gray_frame.type() == CV_8UC1 && gray_frame.cols > 2 && gray_frame.rows > 2 );
+	CV_Assert( points_per_patch > 0 );
+
+	std::vector<Band> bands;
+	getBands( bands, patches );
+	selected.resize( patches.size() * points_per_patch );
+	cv::parallel_for_(
+		cv::Range(0, static_cast<int>(bands.size())),
+		[&](const cv::Range& range) {
+			for (int i = range.start; i < range.end; ++i) processBand( selected, bands[i], gray_frame, patches, points_per_patch );
+		}
+	);
+}
\ No newline at end of file
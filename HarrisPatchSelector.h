@@ -0,0 +1,60 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+struct HarrisPoint
+{
+	float MaxEigenvalue;
+	cv::Point2f Point;
+	cv::Matx<float, 2, 2> HarrisMatrix;
+	bool IsSelected;
+};
+
+// Selects, for every patch, the pixels whose smoothed structure tensors have the largest traces.
+// It fuses the 5x5 gaussian blur, the sobel derivatives, the tensor products and their 5x5 gaussian blur into
+// one streaming pass over row bands, so the blurred, derivative and tensor images are never materialized.
+class HarrisPatchSelector
+{
+public:
+	HarrisPatchSelector();
+	~HarrisPatchSelector() = default;
+
+	// the k-th point of the i-th patch is stored at i * points_per_patch + k, and points of a patch keep a spacing.
+	// a patch with fewer candidates than points fills its remaining slots with IsSelected false.
+	void select(
+		std::vector<HarrisPoint>& selected,
+		const cv::Mat& gray_frame,
+		const std::vector<cv::Rect>& patches,
+		int points_per_patch = 1
+	) const;
+
+private:
+	struct Candidate
+	{
+		float Trace;
+		float IxIx;
+		float IxIy;
+		float IyIy;
+		int X;
+		int Y;
+	};
+
+	struct Band
+	{
+		cv::Rect Region;
+		std::vector<int> PatchIndices;
+	};
+
+	float TensorKernel[5];
+
+	static void getBands(std::vector<Band>& bands, const std::vector<cv::Rect>& patches);
+	static void insertCandidate(std::vector<Candidate>& candidates, const Candidate& candidate, int points_per_patch, int spacing);
+	void processBand(
+		std::vector<HarrisPoint>& selected,
+		const Band& band,
+		const cv::Mat& gray_frame,
+		const std::vector<cv::Rect>& patches,
+		int points_per_patch
+	) const;
+};
\ No newline at end of file
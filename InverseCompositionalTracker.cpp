@@ -0,0 +1,223 @@
+#include "InverseCompositionalTracker.h"
+
+namespace
+{
+	// scharr derivatives of the pyramid are stored unnormalized, that is, 32 times the intensity gradient.
+	constexpr float DerivativeScale = 1.0f / 32.0f;
+
+	template<typename T>
+	void sampleWindow(float* window, const cv::Mat& image, const cv::Point2f& top_left, const cv::Size& size, int channel, int channels)
+	{
+		const int ix = cvFloor( top_left.x );
+		const int iy = cvFloor( top_left.y );
+		const float ax = top_left.x - static_cast<float>(ix);
+		const float ay = top_left.y - static_cast<float>(iy);
+		const float w00 = (1.0f - ax) * (1.0f - ay);
+		const float w01 = ax * (1.0f - ay);
+		const float w10 = (1.0f - ax) * ay;
+		const float w11 = ax * ay;
+		const auto step = static_cast<int>(image.step1());
+		for (int j = 0; j < size.height; ++j) {
+			const T* upper = reinterpret_cast<const T*>(image.data + (iy + j) * static_cast<ptrdiff_t>(image.step)) + ix * channels + channel;
+			const T* lower = upper + step;
+			for (int i = 0; i < size.width; ++i) {
+				const int k = i * channels;
+				*window++ =
+					w00 * static_cast<float>(upper[k]) + w01 * static_cast<float>(upper[k + channels]) +
+					w10 * static_cast<float>(lower[k]) + w11 * static_cast<float>(lower[k + channels]);
+			}
+		}
+	}
+}
+
+InverseCompositionalTracker::InverseCompositionalTracker() :
+	MaxLevel( 0 ), MaxIterations( 30 ), Epsilon( 0.01f ), MinEigenThreshold( 1e-6f )
+{
+}
+
+bool InverseCompositionalTracker::isInside(const cv::Mat& image, const cv::Point2f& top_left) const
+{
+	// pyramid levels are padded by the window size, so a window may hang over the border by half its size.
+	const float half_width = 0.5f * static_cast<float>(WindowSize.width);
+	const float half_height = 0.5f * static_cast<float>(WindowSize.height);
+	return
+		top_left.x >= -half_width && top_left.x + static_cast<float>(WindowSize.width) < static_cast<float>(image.cols) + half_width &&
+		top_left.y >= -half_height && top_left.y + static_cast<float>(WindowSize.height) < static_cast<float>(image.rows) + half_height;
+}
+
+void InverseCompositionalTracker::initialize(
+	const std::vector<cv::Mat>& reference_pyramid,
+	const std::vector<cv::Point2f>& reference_points,
+	const cv::Size& window_size,
+	int max_level
+)
+{
+	CV_Assert( reference_pyramid.size() >= static_cast<size_t>(2 * (max_level + 1)) );
+	CV_Assert( reference_pyramid[1].type() == CV_16SC2 );
+
+	MaxLevel = max_level;
+	WindowSize = window_size;
+	ReferencePoints = reference_points;
+
+	const auto area = static_cast<size_t>(WindowSize.area());
+	const size_t template_num = ReferencePoints.size() * (MaxLevel + 1);
+	LevelTemplates.resize( template_num );
+	Templates.resize( template_num * area );
+	SteepestDescentX.resize( template_num * area );
+	SteepestDescentY.resize( template_num * area );
+
+	cv::parallel_for_(
+		cv::Range(0, static_cast<int>(ReferencePoints.size())),
+		[&](const cv::Range& range) {
+			for (int i = range.start; i < range.end; ++i) initializeTemplates( i, reference_pyramid );
+		}
+	);
+}
+
+void InverseCompositionalTracker::update(
+	const std::vector<cv::Mat>& reference_pyramid,
+	const std::vector<cv::Point2f>& reference_points,
+	const std::vector<int>& point_indices
+)
+{
+	CV_Assert( reference_points.size() == ReferencePoints.size() );
+
+	ReferencePoints = reference_points;
+	for (const auto& index : point_indices) initializeTemplates( index, reference_pyramid );
+}
+
+void InverseCompositionalTracker::initializeTemplates(size_t point_index, const std::vector<cv::Mat>& reference_pyramid)
+{
+	const auto area = static_cast<size_t>(WindowSize.area());
+	const cv::Point2f half_window(
+		0.5f * static_cast<float>(WindowSize.width - 1),
+		0.5f * static_cast<float>(WindowSize.height - 1)
+	);
+	for (int level = 0; level <= MaxLevel; ++level) {
+		const size_t index = getTemplateIndex( point_index, level );
+		const cv::Mat& image = reference_pyramid[level * 2];
+		const cv::Mat& derivatives = reference_pyramid[level * 2 + 1];
+		const float scale = 1.0f / static_cast<float>(1 << level);
+		const cv::Point2f top_left = ReferencePoints[point_index] * scale - half_window;
+
+		LevelTemplate& level_template = LevelTemplates[index];
+		level_template.IsValid = false;
+		if (!isInside( image, top_left )) continue;
+
+		float* t = &Templates[index * area];
+		float* gx = &SteepestDescentX[index * area];
+		float* gy = &SteepestDescentY[index * area];
+		sampleWindow<uchar>( t, image, top_left, WindowSize, 0, 1 );
+		sampleWindow<short>( gx, derivatives, top_left, WindowSize, 0, 2 );
+		sampleWindow<short>( gy, derivatives, top_left, WindowSize, 1, 2 );
+
+		float a11 = 0.0f, a12 = 0.0f, a22 = 0.0f;
+		for (size_t k = 0; k < area; ++k) {
+			gx[k] *= DerivativeScale;
+			gy[k] *= DerivativeScale;
+			a11 += gx[k] * gx[k];
+			a12 += gx[k] * gy[k];
+			a22 += gy[k] * gy[k];
+		}
+
+		// same normalization as the minimum eigenvalue of cv::calcOpticalFlowPyrLK.
+		const float d = a11 * a22 - a12 * a12;
+		const float min_eigenvalue =
+			(a22 + a11 - std::sqrt( (a11 - a22) * (a11 - a22) + 4.0f * a12 * a12 )) /
+			(2.0f * 1024.0f * static_cast<float>(area));
+		level_template.MinEigenvalue = min_eigenvalue;
+		if (min_eigenvalue < MinEigenThreshold || std::abs( d ) < FLT_EPSILON) continue;
+
+		level_template.InverseHessian = cv::Matx<float, 2, 2>(a22, -a12, -a12, a11) * (1.0f / d);
+		level_template.IsValid = true;
+	}
+}
+
+void InverseCompositionalTracker::trackPoint(
+	cv::Point2f& target_point,
+	uchar& found_match,
+	float& error,
+	float* window,
+	size_t point_index,
+	const std::vector<cv::Mat>& pyramid,
+	int pyramid_step
+) const
+{
+	const auto area = static_cast<size_t>(WindowSize.area());
+	const cv::Point2f half_window(
+		0.5f * static_cast<float>(WindowSize.width - 1),
+		0.5f * static_cast<float>(WindowSize.height - 1)
+	);
+
+	found_match = 1;
+	error = 0.0f;
+	cv::Point2f guess = target_point * (1.0f / static_cast<float>(1 << MaxLevel));
+	for (int level = MaxLevel; level >= 0; --level) {
+		const LevelTemplate& level_template = LevelTemplates[getTemplateIndex( point_index, level )];
+		if (!level_template.IsValid) {
+			if (level == 0) found_match = 0;
+			else guess *= 2.0f;
+			continue;
+		}
+
+		const cv::Mat& image = pyramid[level * pyramid_step];
+		const size_t offset = getTemplateIndex( point_index, level ) * area;
+		const float* t = &Templates[offset];
+		const float* gx = &SteepestDescentX[offset];
+		const float* gy = &SteepestDescentY[offset];
+
+		cv::Point2f top_left = guess - half_window;
+		for (int iter = 0; iter < MaxIterations; ++iter) {
+			if (!isInside( image, top_left )) {
+				found_match = 0;
+				return;
+			}
+
+			sampleWindow<uchar>( window, image, top_left, WindowSize, 0, 1 );
+			float b1 = 0.0f, b2 = 0.0f, residual = 0.0f;
+			for (size_t k = 0; k < area; ++k) {
+				const float difference = window[k] - t[k];
+				b1 += gx[k] * difference;
+				b2 += gy[k] * difference;
+				residual += std::abs( difference );
+			}
+			error = residual / static_cast<float>(area);
+
+			const cv::Matx<float, 2, 1> delta = level_template.InverseHessian * cv::Matx<float, 2, 1>(b1, b2);
+			top_left.x -= delta(0);
+			top_left.y -= delta(1);
+			if (delta(0) * delta(0) + delta(1) * delta(1) < Epsilon * Epsilon) break;
+		}
+		guess = top_left + half_window;
+		if (level > 0) guess *= 2.0f;
+	}
+	target_point = guess;
+}
+
+void InverseCompositionalTracker::track(
+	std::vector<cv::Point2f>& target_points,
+	std::vector<uchar>& found_matches,
+	std::vector<float>& errors,
+	const std::vector<cv::Mat>& pyramid,
+	bool use_initial_flow
+) const
+{
+	const int pyramid_step = pyramid.size() > 1 && pyramid[1].type() != pyramid[0].type() ? 2 : 1;
+	CV_Assert( pyramid.size() >= static_cast<size_t>(pyramid_step * MaxLevel + 1) );
+
+	if (!use_initial_flow) target_points = ReferencePoints;
+	CV_Assert( target_points.size() == ReferencePoints.size() );
+	found_matches.resize( ReferencePoints.size() );
+	errors.resize( ReferencePoints.size() );
+
+	cv::parallel_for_(
+		cv::Range(0, static_cast<int>(ReferencePoints.size())),
+		[&](const cv::Range& range) {
+			// windows up to 32x32 live on the stack, so tracking does not allocate per frame.
+			cv::AutoBuffer<float, 1024> window(WindowSize.area());
+			for (int i = range.start; i < range.end; ++i) {
+				trackPoint( target_points[i], found_matches[i], errors[i], window.data(), i, pyramid, pyramid_step );
+			}
+		}
+	);
+}
\ No newline at end of file
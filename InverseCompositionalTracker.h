@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+using uchar = unsigned char;
+using uint = unsigned int;
+
+// Translation-only inverse-compositional Lucas-Kanade tracker for a fixed reference frame.
+// Template windows, steepest-descent images and inverse Hessians are precomputed per point and per level,
+// so tracking a frame only needs image samples, differences and a 2x1 accumulation per iteration.
+class InverseCompositionalTracker
+{
+public:
+	InverseCompositionalTracker();
+	~InverseCompositionalTracker() = default;
+	InverseCompositionalTracker(InverseCompositionalTracker&&) = default;
+	InverseCompositionalTracker& operator=(InverseCompositionalTracker&&) = default;
+
+	void initialize(
+		const std::vector<cv::Mat>& reference_pyramid,
+		const std::vector<cv::Point2f>& reference_points,
+		const cv::Size& window_size,
+		int max_level
+	);
+	// replaces the reference points and recomputes the templates of the given points only.
+	void update(
+		const std::vector<cv::Mat>& reference_pyramid,
+		const std::vector<cv::Point2f>& reference_points,
+		const std::vector<int>& point_indices
+	);
+	void track(
+		std::vector<cv::Point2f>& target_points,
+		std::vector<uchar>& found_matches,
+		std::vector<float>& errors,
+		const std::vector<cv::Mat>& pyramid,
+		bool use_initial_flow
+	) const;
+
+private:
+	struct LevelTemplate
+	{
+		bool IsValid;
+		float MinEigenvalue;
+		cv::Matx<float, 2, 2> InverseHessian;
+	};
+
+	int MaxLevel;
+	int MaxIterations;
+	float Epsilon;
+	float MinEigenThreshold;
+	cv::Size WindowSize;
+	std::vector<cv::Point2f> ReferencePoints;
+	std::vector<LevelTemplate> LevelTemplates;
+	std::vector<float> Templates;
+	std::vector<float> SteepestDescentX;
+	std::vector<float> SteepestDescentY;
+
+	[[nodiscard]] size_t getTemplateIndex(size_t point_index, int level) const { return point_index * (MaxLevel + 1) + level; }
+	[[nodiscard]] bool isInside(const cv::Mat& image, const cv::Point2f& top_left) const;
+	void initializeTemplates(size_t point_index, const std::vector<cv::Mat>& reference_pyramid);
+	void trackPoint(
+		cv::Point2f& target_point,
+		uchar& found_match,
+		float& error,
+		float* window,
+		size_t point_index,
+		const std::vector<cv::Mat>& pyramid,
+		int pyramid_step
+	) const;
+};
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "NormalEquationAccumulator.h"
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace
+{
+	constexpr int UniqueEntryNum = 36;
+
+	inline float getSquareRoot(float value) { return std::sqrt( value ); }
+#if CV_SIMD
+	inline cv::v_float32 getSquareRoot(const cv::v_float32& value) { return cv::v_sqrt( value ); }
+#endif
+
+	// adds the contribution of one point (or one register of points) to the upper triangle of A and to b.
+	template<typename T>
+	void accumulatePoint(
+		T* A,
+		T* b,
+		T& sum_weights,
+		const T& x0, const T& y0, const T& x1, const T& y1,
+		const T& ha, const T& hb, const T& hc,
+		const T* inverse,
+		const T& h6, const T& h7,
+		const T& zero, const T& one,
+		bool to_be_weighted
+	)
+	{
+		T weight = one;
+		if (to_be_weighted) {
+			const T w = inverse[6] * x1 + inverse[7] * y1 + inverse[8];
+			const T ex = (inverse[0] * x1 + inverse[1] * y1 + inverse[2]) / w - x0;
+			const T ey = (inverse[3] * x1 + inverse[4] * y1 + inverse[5]) / w - y0;
+			const T q = ha * ex * ex + (hb + hb) * ex * ey + hc * ey * ey;
+			weight = one / ((one + getSquareRoot( q )) * (h6 * x0 + h7 * y0 + one));
+		}
+
+		const T r1[8] = { x0, y0, one, zero, zero, zero, zero - x1 * x0, zero - x1 * y0 };
+		const T r2[8] = { zero, zero, zero, x0, y0, one, zero - y1 * x0, zero - y1 * y0 };
+		T m1[8], m2[8], wr1[8], wr2[8];
+		for (int i = 0; i < 8; ++i) {
+			m1[i] = ha * r1[i] + hb * r2[i];
+			m2[i] = hb * r1[i] + hc * r2[i];
+			wr1[i] = weight * r1[i];
+			wr2[i] = weight * r2[i];
+		}
+
+		const T dx = x1 - x0;
+		const T dy = y1 - y0;
+		const T e1 = ha * dx + hb * dy;
+		const T e2 = hb * dx + hc * dy;
+		for (int i = 0, k = 0; i < 8; ++i) {
+			b[i] = b[i] + wr1[i] * e1 + wr2[i] * e2;
+			for (int j = i; j < 8; ++j, ++k) A[k] = A[k] + wr1[i] * m1[j] + wr2[i] * m2[j];
+		}
+		sum_weights = sum_weights + weight;
+	}
+}
+
+void NormalEquationAccumulator::setPoints(const PatchTable& patches)
+{
+	const size_t size = patches.ActiveIndices.size();
+	ReferenceX.resize( size );
+	ReferenceY.resize( size );
+	CurrentX.resize( size );
+	CurrentY.resize( size );
+	HarrisA.resize( size );
+	HarrisB.resize( size );
+	HarrisC.resize( size );
+	for (size_t i = 0; i < size; ++i) {
+		const int index = patches.ActiveIndices[i];
+		ReferenceX[i] = patches.ReferenceX[index];
+		ReferenceY[i] = patches.ReferenceY[index];
+		CurrentX[i] = patches.CurrentX[index];
+		CurrentY[i] = patches.CurrentY[index];
+		HarrisA[i] = patches.HarrisA[index];
+		HarrisB[i] = patches.HarrisB[index];
+		HarrisC[i] = patches.HarrisC[index];
+	}
+}
+
+float NormalEquationAccumulator::accumulate(
+	cv::Matx<float, 8, 8>& A,
+	cv::Matx<float, 8, 1>& b,
+	const cv::Matx<float, 3, 3>& inverse_homography,
+	const cv::Matx<float, 8, 1>& h,
+	bool to_be_weighted
+) const
+{
+	float upper[UniqueEntryNum] = {};
+	float rhs[8] = {};
+	float sum_weights = 0.0f;
+	const int size = getPointNum();
+	int i = 0;
+#if CV_SIMD
+	{
+		const cv::v_float32 zero = cv::vx_setzero_f32();
+		const cv::v_float32 one = cv::vx_setall_f32( 1.0f );
+		const cv::v_float32 h6 = cv::vx_setall_f32( h(6) );
+		const cv::v_float32 h7 = cv::vx_setall_f32( h(7) );
+		cv::v_float32 inverse[9];
+		for (int k = 0; k < 9; ++k) inverse[k] = cv::vx_setall_f32( inverse_homography.val[k] );
+
+		cv::v_float32 upper_lanes[UniqueEntryNum], rhs_lanes[8], sum_lanes = zero;
+		for (auto& lanes : upper_lanes) lanes = zero;
+		for (auto& lanes : rhs_lanes) lanes = zero;
+		for (; i <= size - cv::v_float32::nlanes; i += cv::v_float32::nlanes) {
+			accumulatePoint(
+				upper_lanes, rhs_lanes, sum_lanes,
+				cv::vx_load_aligned( &ReferenceX[i] ), cv::vx_load_aligned( &ReferenceY[i] ),
+				cv::vx_load_aligned( &CurrentX[i] ), cv::vx_load_aligned( &CurrentY[i] ),
+				cv::vx_load_aligned( &HarrisA[i] ), cv::vx_load_aligned( &HarrisB[i] ), cv::vx_load_aligned( &HarrisC[i] ),
+				inverse, h6, h7, zero, one, to_be_weighted
+			);
+		}
+		for (int k = 0; k < UniqueEntryNum; ++k) upper[k] = cv::v_reduce_sum( upper_lanes[k] );
+		for (int k = 0; k < 8; ++k) rhs[k] = cv::v_reduce_sum( rhs_lanes[k] );
+		sum_weights = cv::v_reduce_sum( sum_lanes );
+	}
+#endif
+	for (; i < size; ++i) {
+		accumulatePoint(
+			upper, rhs, sum_weights,
+			ReferenceX[i], ReferenceY[i], CurrentX[i], CurrentY[i], HarrisA[i], HarrisB[i], HarrisC[i],
+			inverse_homography.val, h(6), h(7), 0.0f, 1.0f, to_be_weighted
+		);
+	}
+
+	for (int r = 0, k = 0; r < 8; ++r) {
+		b(r) = rhs[r];
+		for (int c = r; c < 8; ++c, ++k) A(r, c) = A(c, r) = upper[k];
+	}
+	return sum_weights;
+}
+
+float NormalEquationAccumulator::getMeanResidual(const cv::Matx<float, 3, 3>& inverse_homography) const
+{
+	const int size = getPointNum();
+	if (size == 0) return 0.0f;
+
+	float sum = 0.0f;
+	for (int i = 0; i < size; ++i) {
+		const cv::Point3f mapped = inverse_homography * cv::Point3f(CurrentX[i], CurrentY[i], 1.0f);
+		sum += std::hypot( mapped.x / mapped.z - ReferenceX[i], mapped.y / mapped.z - ReferenceY[i] );
+	}
+	return sum / static_cast<float>(size);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "PatchTable.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Accumulates the weighted normal equations A = sum w J^T H J and b = sum w J^T H (p1 - p0) of the homography update.
+// Points are kept as compacted structure-of-arrays, so several points are processed per SIMD register and
+// only the 36 unique entries of the symmetric A are accumulated.
+class NormalEquationAccumulator
+{
+public:
+	NormalEquationAccumulator() = default;
+	~NormalEquationAccumulator() = default;
+
+	void setPoints(const PatchTable& patches);
+	[[nodiscard]] int getPointNum() const { return static_cast<int>(ReferenceX.size()); }
+	float accumulate(
+		cv::Matx<float, 8, 8>& A,
+		cv::Matx<float, 8, 1>& b,
+		const cv::Matx<float, 3, 3>& inverse_homography,
+		const cv::Matx<float, 8, 1>& h,
+		bool to_be_weighted
+	) const;
+
+	// the mean distance between the reference points and the current points mapped back by the inverse homography.
+	[[nodiscard]] float getMeanResidual(const cv::Matx<float, 3, 3>& inverse_homography) const;
+
+private:
+	PatchTable::Column<float> ReferenceX;
+	PatchTable::Column<float> ReferenceY;
+	PatchTable::Column<float> CurrentX;
+	PatchTable::Column<float> CurrentY;
+	PatchTable::Column<float> HarrisA;
+	PatchTable::Column<float> HarrisB;
+	PatchTable::Column<float> HarrisC;
+};
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include "OfflineStabilization.h"
+
+OfflineStabilization::OfflineStabilization(
+	const PatchStabilization::Config& config,
+	double crop_ratio,
+	double first_difference_lambda,
+	double second_difference_lambda
+) :
+	Settings( config ), CropRatio( std::min( std::max( crop_ratio, 0.1 ), 1.0 ) ),
+	FirstDifferenceLambda( std::max( first_difference_lambda, 0.0 ) ),
+	SecondDifferenceLambda( std::max( second_difference_lambda, 0.0 ) )
+{
+	// the first pass only needs the motion, so it runs at half resolution at least.
+	Settings.MotionScale = std::max( Settings.MotionScale, 2 );
+}
+
+bool OfflineStabilization::estimateMotion(const std::string& video_path)
+{
+	cv::VideoCapture capture(video_path);
+	if (!capture.isOpened()) return false;
+
+	PatchStabilization stabilizer(Settings);
+	StabilizingHomographies.clear();
+	cv::Mat frame, stabilizing_homography;
+	while (capture.read( frame )) {
+		stabilizer.estimate( stabilizing_homography, frame );
+		StabilizingHomographies.emplace_back( cv::Matx<float, 3, 3>(stabilizing_homography) );
+		FrameSize = frame.size();
+	}
+	if (StabilizingHomographies.empty()) return false;
+
+	OutputRegion = stabilizer.getOutputRegion( FrameSize );
+	if (Settings.OutputCrop.empty()) {
+		const cv::Size crop_size(cvRound( FrameSize.width * CropRatio ), cvRound( FrameSize.height * CropRatio ));
+		OutputRegion = cv::Rect(cv::Point((FrameSize.width - crop_size.width) / 2, (FrameSize.height - crop_size.height) / 2), crop_size);
+	}
+	return true;
+}
+
+OfflineStabilization::Parameters OfflineStabilization::toParameters(const TrajectorySmoother::Motion& motion) const
+{
+	// every parameter is scaled to the pixel displacement it causes at the corner, so one lambda fits all of them.
+	const double radius = 0.5 * std::hypot( FrameSize.width, FrameSize.height );
+	return {
+		motion.Tx, motion.Ty, motion.Angle * radius, motion.LogScale * radius,
+		motion.Remainder(0, 0) * radius, motion.Remainder(0, 1) * radius, motion.Remainder(1, 0) * radius, motion.Remainder(1, 1) * radius,
+		motion.H20 * radius * radius, motion.H21 * radius * radius
+	};
+}
+
+TrajectorySmoother::Motion OfflineStabilization::toMotion(const Parameters& parameters) const
+{
+	const double radius = 0.5 * std::hypot( FrameSize.width, FrameSize.height );
+	TrajectorySmoother::Motion motion{};
+	motion.Tx = parameters[0];
+	motion.Ty = parameters[1];
+	motion.Angle = parameters[2] / radius;
+	motion.LogScale = parameters[3] / radius;
+	motion.Remainder = cv::Matx<double, 2, 2>(parameters[4], parameters[5], parameters[6], parameters[7]) * (1.0 / radius);
+	motion.H20 = parameters[8] / (radius * radius);
+	motion.H21 = parameters[9] / (radius * radius);
+	return motion;
+}
+
+void OfflineStabilization::solvePentadiagonal(
+	std::vector<double>& x,
+	std::vector<double>& diagonal,
+	std::vector<double>& first_band,
+	std::vector<double>& second_band,
+	const std::vector<double>& b
+)
+{
+	// banded cholesky in place: diagonal[i] = L(i, i), first_band[i] = L(i + 1, i), second_band[i] = L(i + 2, i).
+	const auto n = static_cast<int>(b.size());
+	for (int i = 0; i < n; ++i) {
+		if (i >= 2) second_band[i - 2] /= diagonal[i - 2];
+		if (i >= 1) {
+			if (i >= 2) first_band[i - 1] -= second_band[i - 2] * first_band[i - 2];
+			first_band[i - 1] /= diagonal[i - 1];
+		}
+		double d = diagonal[i];
+		if (i >= 1) d -= first_band[i - 1] * first_band[i - 1];
+		if (i >= 2) d -= second_band[i - 2] * second_band[i - 2];
+		diagonal[i] = std::sqrt( std::max( d, 1e-12 ) );
+	}
+
+	x.resize( n );
+	for (int i = 0; i < n; ++i) {
+		double y = b[i];
+		if (i >= 1) y -= first_band[i - 1] * x[i - 1];
+		if (i >= 2) y -= second_band[i - 2] * x[i - 2];
+		x[i] = y / diagonal[i];
+	}
+	for (int i = n - 1; i >= 0; --i) {
+		double y = x[i];
+		if (i + 1 < n) y -= first_band[i] * x[i + 1];
+		if (i + 2 < n) y -= second_band[i] * x[i + 2];
+		x[i] = y / diagonal[i];
+	}
+}
+
+void OfflineStabilization::optimizeParameter(std::vector<double>& optimized, const std::vector<double>& path) const
+{
+	// min sum (p - c)^2 + l1 * sum |D1 p| + l2 * sum |D2 p|. IRLS replaces |d| by d^2 / (2 |d|) of the last iterate,
+	// which has the same gradient there.
+	static const double min_difference = 1e-2;
+	const auto n = static_cast<int>(path.size());
+	optimized = path;
+	if (n < 3) return;
+
+	std::vector<double> diagonal(n), first_band(n), second_band(n);
+	for (int iteration = 0; iteration < IrlsIterationNum; ++iteration) {
+		std::fill( diagonal.begin(), diagonal.end(), 1.0 );
+		std::fill( first_band.begin(), first_band.end(), 0.0 );
+		std::fill( second_band.begin(), second_band.end(), 0.0 );
+		for (int t = 0; t + 1 < n; ++t) {
+			const double w = 0.5 * FirstDifferenceLambda / std::max( std::abs( optimized[t + 1] - optimized[t] ), min_difference );
+			diagonal[t] += w;
+			diagonal[t + 1] += w;
+			first_band[t] -= w;
+		}
+		for (int t = 1; t + 1 < n; ++t) {
+			const double w =
+				0.5 * SecondDifferenceLambda / std::max( std::abs( optimized[t + 1] - 2.0 * optimized[t] + optimized[t - 1] ), min_difference );
+			// (p[t - 1] - 2 p[t] + p[t + 1])^2 adds w * [1 -2 1]^T [1 -2 1] around t.
+			diagonal[t - 1] += w;
+			diagonal[t] += 4.0 * w;
+			diagonal[t + 1] += w;
+			first_band[t - 1] -= 2.0 * w;
+			first_band[t] -= 2.0 * w;
+			second_band[t - 1] += w;
+		}
+		solvePentadiagonal( optimized, diagonal, first_band, second_band, path );
+	}
+}
+
+bool OfflineStabilization::isCropCovered(const cv::Matx<double, 3, 3>& warp) const
+{
+	// the output crop is convex, so it is inside the frame when its corners map back into the frame.
+	const cv::Matx<double, 3, 3> inverse = warp.inv();
+	const cv::Point2d corners[4] = {
+		cv::Point2d(OutputRegion.x, OutputRegion.y), cv::Point2d(OutputRegion.br().x, OutputRegion.y),
+		cv::Point2d(OutputRegion.x, OutputRegion.br().y), cv::Point2d(OutputRegion.br().x, OutputRegion.br().y)
+	};
+	for (const auto& corner : corners) {
+		const cv::Vec3d p = inverse * cv::Vec3d(corner.x, corner.y, 1.0);
+		if (p[2] <= 0.0) return false;
+
+		const double x = p[0] / p[2], y = p[1] / p[2];
+		if (x < 0.0 || y < 0.0 || x > FrameSize.width - 1.0 || y > FrameSize.height - 1.0) return false;
+	}
+	return true;
+}
+
+void OfflineStabilization::optimizePath()
+{
+	const auto n = static_cast<int>(StabilizingHomographies.size());
+	std::vector<Parameters> path(n);
+	for (int t = 0; t < n; ++t) {
+		path[t] = toParameters( TrajectorySmoother::decompose( cv::Matx<double, 3, 3>(StabilizingHomographies[t]) ) );
+		// the angle is unwrapped, so the path has no jump at pi.
+		if (t > 0) {
+			const double radius = 0.5 * std::hypot( FrameSize.width, FrameSize.height );
+			path[t][2] = path[t - 1][2] + std::remainder( path[t][2] - path[t - 1][2], 2.0 * CV_PI * radius );
+		}
+	}
+
+	std::vector<Parameters> smoothed(n);
+	std::vector<double> series(n), optimized;
+	for (int k = 0; k < ParameterNum; ++k) {
+		for (int t = 0; t < n; ++t) series[t] = path[t][k];
+		optimizeParameter( optimized, series );
+		for (int t = 0; t < n; ++t) smoothed[t][k] = optimized[t];
+	}
+
+	// the largest blend toward the smoothed path that keeps the crop inside the frame is found by bisection.
+	// a blend of 0 is the original path, whose warp is the identity.
+	const auto get_warp = [&](int t, double alpha) {
+		const Parameters blended = path[t] * (1.0 - alpha) + smoothed[t] * alpha;
+		return TrajectorySmoother::compose( toMotion( blended ) ).inv() * cv::Matx<double, 3, 3>(StabilizingHomographies[t]);
+	};
+	std::vector<double> alphas(n, 1.0);
+	for (int t = 0; t < n; ++t) {
+		if (isCropCovered( get_warp( t, 1.0 ) )) continue;
+
+		double lower = 0.0, upper = 1.0;
+		for (int i = 0; i < 12; ++i) {
+			const double middle = 0.5 * (lower + upper);
+			if (isCropCovered( get_warp( t, middle ) )) lower = middle;
+			else upper = middle;
+		}
+		alphas[t] = lower;
+	}
+
+	// a minimum filter followed by a box filter of the same radius never exceeds the feasible blend of a frame,
+	// and turns its steps into ramps.
+	std::vector<double> minimums(n), blends(n);
+	for (int t = 0; t < n; ++t) {
+		minimums[t] = 1.0;
+		for (int s = std::max( t - BlendRadius, 0 ); s <= std::min( t + BlendRadius, n - 1 ); ++s) minimums[t] = std::min( minimums[t], alphas[s] );
+	}
+	for (int t = 0; t < n; ++t) {
+		double sum = 0.0;
+		int count = 0;
+		for (int s = std::max( t - BlendRadius, 0 ); s <= std::min( t + BlendRadius, n - 1 ); ++s, ++count) sum += minimums[s];
+		blends[t] = sum / count;
+	}
+
+	Warps.resize( n );
+	for (int t = 0; t < n; ++t) Warps[t] = cv::Matx<float, 3, 3>(get_warp( t, blends[t] ));
+}
+
+int64_t OfflineStabilization::render(cv::VideoWriter& writer, const std::string& video_path)
+{
+	cv::VideoCapture capture(video_path);
+	if (!capture.isOpened()) return 0;
+
+	// the warps already map into the stabilized frame, so the renderer only carries the crop.
+	PatchStabilization::Config config = Settings;
+	config.OutputCrop = OutputRegion;
+	PatchStabilization renderer(config);
+	int64_t frame_num = 0;
+	cv::Mat frame, stabilized;
+	while (frame_num < static_cast<int64_t>(Warps.size()) && capture.read( frame )) {
+		renderer.warp( stabilized, frame, cv::Mat(Warps[frame_num], false) );
+		writer.write( stabilized );
+		frame_num++;
+	}
+	return frame_num;
+}
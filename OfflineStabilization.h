@@ -0,0 +1,67 @@
+#pragma once
+
+#include "PatchStabilization.h"
+#include "TrajectorySmoother.h"
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Stabilizes a whole video in two decoding passes around a global path optimization.
+// The first pass only estimates the camera path on the downscaled gray frames, without any color warp.
+// The path is then optimized over the whole video, each decomposed parameter with an L2 data term and L1 penalties on
+// its first and second differences (static shots and constant pans), solved by IRLS with a pentadiagonal system.
+// Wherever the optimized path would pull the border of the frame into the output crop, it is blended back toward the
+// original path. The second pass warps every frame once, straight into the output crop.
+class OfflineStabilization
+{
+public:
+	// crop_ratio is the side of the centered output crop relative to the frame, used when config.OutputCrop is empty.
+	// the lambdas weigh the first and second differences against the data term, in pixels.
+	OfflineStabilization(
+		const PatchStabilization::Config& config,
+		double crop_ratio = 0.9,
+		double first_difference_lambda = 20.0,
+		double second_difference_lambda = 50.0
+	);
+	~OfflineStabilization() = default;
+
+	// the first pass. returns false if the video cannot be read.
+	bool estimateMotion(const std::string& video_path);
+
+	// fills the warp of every estimated frame, which maps it into the output crop.
+	void optimizePath();
+
+	// the second pass. returns the number of frames written.
+	int64_t render(cv::VideoWriter& writer, const std::string& video_path);
+
+	[[nodiscard]] cv::Rect getOutputRegion() const { return OutputRegion; }
+	[[nodiscard]] const std::vector<cv::Matx<float, 3, 3>>& getStabilizingHomographies() const { return StabilizingHomographies; }
+	[[nodiscard]] const std::vector<cv::Matx<float, 3, 3>>& getWarps() const { return Warps; }
+
+private:
+	static constexpr int ParameterNum = 10;
+	static constexpr int IrlsIterationNum = 20;
+	static constexpr int BlendRadius = 15;
+	using Parameters = cv::Vec<double, ParameterNum>;
+
+	PatchStabilization::Config Settings;
+	double CropRatio;
+	double FirstDifferenceLambda;
+	double SecondDifferenceLambda;
+	cv::Size FrameSize;
+	cv::Rect OutputRegion;
+	std::vector<cv::Matx<float, 3, 3>> StabilizingHomographies;
+	std::vector<cv::Matx<float, 3, 3>> Warps;
+
+	[[nodiscard]] Parameters toParameters(const TrajectorySmoother::Motion& motion) const;
+	[[nodiscard]] TrajectorySmoother::Motion toMotion(const Parameters& parameters) const;
+	void optimizeParameter(std::vector<double>& optimized, const std::vector<double>& path) const;
+	[[nodiscard]] bool isCropCovered(const cv::Matx<double, 3, 3>& warp) const;
+	static void solvePentadiagonal(
+		std::vector<double>& x,
+		std::vector<double>& diagonal,
+		std::vector<double>& first_band,
+		std::vector<double>& second_band,
+		const std::vector<double>& b
+	);
+};
@@ -1,175 +1,479 @@
 #include "PatchStabilization.h"
 
-PatchStabilization::PatchStabilization() : PatchColNum( 20 ), PatchRowNum( 15 )
+PatchStabilization::PatchStabilization(const Config& config) :
+	Settings( config ), IsWarmStarted( false ), Statistics{}, AdaptationFrameNum( 0 ), AdaptationTime( 0.0 ),
+	AdaptationValidRatio( 0.0 ), IsNextKeyframeDiscarded( false )
 {
-	Homography = cv::Mat::eye(3, 3, CV_32FC1);
+	CV_Assert( Settings.PatchColNum > 0 && Settings.PatchRowNum > 0 && Settings.PointsPerPatch > 0 );
+	CV_Assert( Settings.MotionScale == 1 || Settings.MotionScale == 2 || Settings.MotionScale == 4 );
+
+	Settings.MaxIterationNum = std::max( Settings.MaxIterationNum, 1u );
+	Homography = cv::Matx<float, 3, 3>::eye();
+	KeyframeAnchor = cv::Matx<float, 3, 3>::eye();
+	StabilizingHomography = cv::Matx<float, 3, 3>::eye();
+	NextKeyframeHomography = cv::Matx<float, 3, 3>::eye();
+	PreviousParameters = cv::Matx<float, 8, 1>::zeros();
+	Reference.PatchColNum = Settings.PatchColNum;
+	Reference.PatchRowNum = Settings.PatchRowNum;
 }
 
-void PatchStabilization::setReferencePointsAndEigenvalues(
-	const cv::Rect& patch, 
-	int patch_index, 
-	const std::vector<cv::Mat>& derivatives
-)
+size_t PatchStabilization::getMaxPointNum() const
 {
-	const cv::Mat& IxIx = derivatives[0];
-	const cv::Mat& IxIy = derivatives[1];
-	const cv::Mat& IyIy = derivatives[2];
-
-	float max_trace = -1.0f;
-	for (int j = patch.y; j < patch.br().y; ++j) {
-		for (int i = patch.x; i < patch.br().x; ++i) {
-			const cv::Matx<float, 2, 2> harris_matrix = { 
-				IxIx.at<float>(j, i), IxIy.at<float>(j, i),
-				IxIy.at<float>(j, i), IyIy.at<float>(j, i)
-			};
-
-			const float trace = harris_matrix(0, 0) + harris_matrix(1, 1);
-			if (trace > max_trace) {
-				HarrisMatrices[patch_index] = harris_matrix;
-				ReferencePoints[patch_index] = cv::Point2f(static_cast<float>(i), static_cast<float>(j));
-
-				max_trace = trace;
-				const float t = 
-					(harris_matrix(0, 0) - harris_matrix(1, 1)) * (harris_matrix(0, 0) - harris_matrix(1, 1)) + 
-					4.0f * harris_matrix(0, 1) * harris_matrix(1, 0);
-				MaxEigenvalues[patch_index] = 0.5f * (trace + std::sqrt( t ));
-			}
+	int col_num = Settings.PatchColNum;
+	int row_num = Settings.PatchRowNum;
+	if (Settings.IsGridAdaptive) {
+		col_num = std::max( col_num, Settings.MaxPatchColNum );
+		row_num = std::max( row_num, cvCeil( static_cast<double>(col_num * Settings.PatchRowNum) / Settings.PatchColNum ) );
+	}
+	return static_cast<size_t>(col_num) * row_num * Settings.PointsPerPatch;
+}
+
+void PatchStabilization::prepareWorkspace(const cv::Size& frame_size)
+{
+	if (Buffers.FrameSize == frame_size) return;
+
+	Buffers.FrameSize = frame_size;
+	const cv::Size motion_size(frame_size.width / Settings.MotionScale, frame_size.height / Settings.MotionScale);
+	Buffers.GrayFrame.create( frame_size, CV_8UC1 );
+	if (Settings.MotionScale > 1) Buffers.MotionFrame.create( motion_size, CV_8UC1 );
+	Buffers.TrackedFrame.create( motion_size, CV_8UC1 );
+
+	// the grid may grow up to its adaptive limit, so the point buffers are reserved for the largest one.
+	const size_t max_point_num = getMaxPointNum();
+	const size_t max_patch_num = max_point_num / Settings.PointsPerPatch;
+	Buffers.TrackedPoints.reserve( max_point_num );
+	Buffers.ReReferencePoints.reserve( max_point_num );
+	Buffers.ForwardFoundMatches.reserve( max_point_num );
+	Buffers.BackwardFoundMatches.reserve( max_point_num );
+	Buffers.Errors.reserve( max_point_num );
+	Buffers.DeadPatches.reserve( max_patch_num );
+	Buffers.DeadPatchIndices.reserve( max_patch_num );
+	Buffers.ReseededPointIndices.reserve( max_point_num );
+	Buffers.SelectedPoints.reserve( max_point_num );
+	Buffers.Pyramid.reserve( 2 * (Settings.PyramidLevel + 1) );
+}
+
+void PatchStabilization::selectPatches(Keyframe& keyframe) const
+{
+	// patch borders are distributed over the whole frame, so the remainder of the division is covered as well.
+	const int width = keyframe.GrayFrame.cols;
+	const int height = keyframe.GrayFrame.rows;
+	keyframe.PatchRects.resize( keyframe.PatchColNum * keyframe.PatchRowNum );
+	keyframe.ReseedFrames.assign( keyframe.PatchRects.size(), 0 );
+	keyframe.ReseedWaits.assign( keyframe.PatchRects.size(), 0 );
+	for (int pj = 0; pj < keyframe.PatchRowNum; ++pj) {
+		const int top = pj * height / keyframe.PatchRowNum;
+		const int bottom = (pj + 1) * height / keyframe.PatchRowNum;
+		for (int pi = 0; pi < keyframe.PatchColNum; ++pi) {
+			const int left = pi * width / keyframe.PatchColNum;
+			const int right = (pi + 1) * width / keyframe.PatchColNum;
+			keyframe.PatchRects[pj * keyframe.PatchColNum + pi] = cv::Rect(left, top, right - left, bottom - top);
 		}
 	}
+
+	std::vector<HarrisPoint> selected;
+	PatchSelector.select( selected, keyframe.GrayFrame, keyframe.PatchRects, Settings.PointsPerPatch );
+
+	keyframe.Patches.resize( selected.size() );
+	for (size_t i = 0; i < selected.size(); ++i) keyframe.Patches.setPatch( i, selected[i] );
+
+	if (Settings.TrackerType == TRACKER_TYPE::INVERSE_COMPOSITIONAL) {
+		keyframe.InverseCompositional.initialize(
+			keyframe.Pyramid, keyframe.Patches.ReferencePoints, Settings.WindowSize, keyframe.PyramidLevel
+		);
+	}
+}
+
+void PatchStabilization::prepareKeyframe(Keyframe& keyframe, const cv::Mat& gray_frame) const
+{
+	keyframe.GrayFrame = gray_frame.clone();
+
+	// a keyframe serves many frames, so its pyramid and derivatives are built only once here.
+	keyframe.PyramidLevel = cv::buildOpticalFlowPyramid(
+		keyframe.GrayFrame, keyframe.Pyramid, Settings.WindowSize, Settings.PyramidLevel, true
+	);
+	selectPatches( keyframe );
+}
+
+void PatchStabilization::updateGridStatistics()
+{
+	Statistics.PatchColNum = Reference.PatchColNum;
+	Statistics.PatchRowNum = Reference.PatchRowNum;
+	Statistics.PointNum = static_cast<uint>(Reference.Patches.size());
 }
 
 void PatchStabilization::initialize(const cv::Mat& reference_gray_frame)
 {
-	ReferenceGrayFrame = reference_gray_frame.clone();
+	prepareKeyframe( Reference, reference_gray_frame );
+	updateGridStatistics();
+}
+
+void PatchStabilization::adaptGrid(double frame_time)
+{
+	AdaptationTime += frame_time;
+	AdaptationValidRatio += static_cast<double>(Reference.Patches.ActiveIndices.size()) / static_cast<double>(Reference.Patches.size());
+	if (++AdaptationFrameNum < Settings.AdaptationInterval) return;
+
+	const double mean_time = AdaptationTime / AdaptationFrameNum;
+	const double valid_ratio = AdaptationValidRatio / AdaptationFrameNum;
+	AdaptationFrameNum = 0;
+	AdaptationTime = 0.0;
+	AdaptationValidRatio = 0.0;
+
+	const int current_col_num = Reference.PatchColNum;
+	int col_num = current_col_num;
+	if (mean_time > Settings.FrameTimeBudget) col_num = cvFloor( current_col_num * 0.8 );
+	else if (valid_ratio < Settings.MinValidRatio && mean_time < 0.75 * Settings.FrameTimeBudget) {
+		col_num = cvCeil( current_col_num * 1.25 );
+	}
+	col_num = std::min( std::max( col_num, Settings.MinPatchColNum ), Settings.MaxPatchColNum );
+	if (col_num == current_col_num) return;
+
+	Reference.PatchColNum = col_num;
+	Reference.PatchRowNum = std::max( cvRound( static_cast<double>(col_num * Settings.PatchRowNum) / Settings.PatchColNum ), 1 );
+	selectPatches( Reference );
+	updateGridStatistics();
+
+	// a keyframe still being prepared has the old grid, and installing it would revert the adaptation.
+	if (KeyframeTask.valid()) IsNextKeyframeDiscarded = true;
+}
 
-	cv::Mat blurred;
-	cv::GaussianBlur( ReferenceGrayFrame, blurred, cv::Size(5, 5), 1.0 );
-	blurred.convertTo( blurred, CV_32FC1 );
+bool PatchStabilization::needsNewKeyframe() const
+{
+	const double active_ratio =
+		static_cast<double>(Reference.Patches.ActiveIndices.size()) / static_cast<double>(Reference.Patches.size());
+	if (active_ratio < Settings.ReanchorActiveRatio) return true;
+
+	const auto width = static_cast<float>(Reference.GrayFrame.cols);
+	const auto height = static_cast<float>(Reference.GrayFrame.rows);
+	cv::Point2f bounds[4] = {
+		cv::Point2f(0.0f, 0.0f), cv::Point2f(width, 0.0f), cv::Point2f(width, height), cv::Point2f(0.0f, height)
+	};
+	cv::Point2f mapped_bounds[4];
+	const cv::Mat bound_points(4, 1, CV_32FC2, bounds);
+	cv::Mat mapped_bound_points(4, 1, CV_32FC2, mapped_bounds);
+	cv::perspectiveTransform( bound_points, mapped_bound_points, Homography );
+	const float overlap_area = cv::intersectConvexConvex( mapped_bound_points, bound_points, cv::noArray() );
+	return overlap_area < Settings.ReanchorOverlapRatio * width * height;
+}
 
-	cv::Mat dx, dy;
-	cv::Sobel( blurred, dx, CV_32FC1, 1, 0 );
-	cv::Sobel( blurred, dy, CV_32FC1, 0, 1 );
+void PatchStabilization::requestKeyframe(const cv::Mat& gray_frame)
+{
+	// the current keyframe keeps serving frames while the next one is built on a worker thread.
+	NextKeyframe.PatchColNum = Reference.PatchColNum;
+	NextKeyframe.PatchRowNum = Reference.PatchRowNum;
+	NextKeyframeHomography = Homography;
+	IsNextKeyframeDiscarded = false;
+
+	// the gray frame lives in the workspace and is overwritten by the next frame, so the worker gets its own copy.
+	KeyframeTask = std::async(
+		std::launch::async, [this, gray_frame = gray_frame.clone()]() { prepareKeyframe( NextKeyframe, gray_frame ); }
+	);
+}
 
-	std::vector<cv::Mat> derivatives(3);
-	cv::multiply( dx, dx, derivatives[0] );
-	cv::multiply( dx, dy, derivatives[1] );
-	cv::multiply( dy, dy, derivatives[2] );
+void PatchStabilization::installNextKeyframe()
+{
+	// the anchor absorbs the homography of the new keyframe, so the stabilized output does not jump at the switch.
+	Homography = NextKeyframeHomography.inv() * Homography;
+	KeyframeAnchor = KeyframeAnchor * NextKeyframeHomography;
+	std::swap( Reference, NextKeyframe );
+	IsWarmStarted = false;
+	Statistics.KeyframeNum++;
+	updateGridStatistics();
+}
 
-	cv::GaussianBlur( derivatives[0], derivatives[0], cv::Size(5, 5), 2.0 );
-	cv::GaussianBlur( derivatives[1], derivatives[1], cv::Size(5, 5), 2.0 );
-	cv::GaussianBlur( derivatives[2], derivatives[2], cv::Size(5, 5), 2.0 );
+void PatchStabilization::updateReferenceRegion(const cv::Rect& region)
+{
+	// only the pyramid pixels that depend on the changed region are recomputed, level by level.
+	// the padding of a level is refreshed only when the region reaches the border of that level.
+	cv::Rect changed = region;
+	for (int level = 0; level <= Reference.PyramidLevel; ++level) {
+		cv::Mat& image = Reference.Pyramid[level * 2];
+		const cv::Rect bounds(0, 0, image.cols, image.rows);
+		if (level > 0) {
+			// pyrDown reads the 5x5 neighborhood of (2x, 2y), and the source window starts at an even position.
+			const cv::Mat& finer = Reference.Pyramid[(level - 1) * 2];
+			changed = cv::Rect(
+				cv::Point((changed.x - 2) >> 1, (changed.y - 2) >> 1),
+				cv::Point(((changed.br().x + 1) >> 1) + 1, ((changed.br().y + 1) >> 1) + 1)
+			) & bounds;
+			const cv::Rect source = cv::Rect(
+				cv::Point(std::max( 2 * changed.x - 2, 0 ), std::max( 2 * changed.y - 2, 0 )),
+				cv::Point(std::min( 2 * changed.br().x + 2, finer.cols ), std::min( 2 * changed.br().y + 2, finer.rows ))
+			);
+			cv::Mat reduced;
+			cv::pyrDown( finer(source), reduced );
+			reduced(cv::Rect(changed.tl() - source.tl() / 2, changed.size())).copyTo( image(changed) );
+		}
 
-	HarrisMatrices.resize( PatchColNum * PatchRowNum );
-	ReferencePoints.resize( PatchColNum * PatchRowNum );
-	MaxEigenvalues.resize( PatchColNum * PatchRowNum );
+		const cv::Rect derivative_region = cv::Rect(changed.x - 1, changed.y - 1, changed.width + 2, changed.height + 2) & bounds;
+		const cv::Rect source = cv::Rect(derivative_region.x - 1, derivative_region.y - 1, derivative_region.width + 2, derivative_region.height + 2) & bounds;
+		cv::Mat dx, dy, derivatives;
+		cv::Scharr( image(source), dx, CV_16S, 1, 0, 1.0, 0.0, cv::BORDER_REFLECT_101 | cv::BORDER_ISOLATED );
+		cv::Scharr( image(source), dy, CV_16S, 0, 1, 1.0, 0.0, cv::BORDER_REFLECT_101 | cv::BORDER_ISOLATED );
+		const cv::Rect inner(derivative_region.tl() - source.tl(), derivative_region.size());
+		cv::merge( std::vector<cv::Mat>{ dx(inner), dy(inner) }, derivatives );
+		derivatives.copyTo( Reference.Pyramid[level * 2 + 1](derivative_region) );
+
+		cv::Size whole_size;
+		cv::Point offset;
+		image.locateROI( whole_size, offset );
+		const int bottom = whole_size.height - offset.y - image.rows;
+		const int right = whole_size.width - offset.x - image.cols;
+		if (changed.x <= offset.x || changed.y <= offset.y || changed.br().x >= image.cols - right || changed.br().y >= image.rows - bottom) {
+			cv::Mat padded = image;
+			padded.adjustROI( offset.y, bottom, offset.x, right );
+			cv::copyMakeBorder( image.clone(), padded, offset.y, bottom, offset.x, right, cv::BORDER_REFLECT_101 | cv::BORDER_ISOLATED );
+		}
+	}
+}
 
-	const auto patch_width = static_cast<int>(ReferenceGrayFrame.cols) / PatchColNum;
-	const auto patch_height = static_cast<int>(ReferenceGrayFrame.rows) / PatchRowNum;
-	for (int pj = 0; pj < PatchRowNum; ++pj) {
-		for (int pi = 0; pi < PatchColNum; ++pi) {
-			const int patch_index = pj * PatchColNum + pi;
-			const cv::Rect patch(static_cast<int>(pi * patch_width), static_cast<int>(pj * patch_height), patch_width, patch_height);
-			setReferencePointsAndEigenvalues( patch, patch_index, derivatives );
+void PatchStabilization::reseedDeadPatches(const cv::Mat& gray_frame)
+{
+	// the harris selection reads 5 pixels around a candidate (blur, sobel and tensor blur), and the tracking window
+	// reads half of its size, so the replaced content reaches that far beyond the patch. the seam it leaves against
+	// the old content is then out of reach of both the selection and the windows of the new points.
+	static constexpr int harris_halo = 5;
+	const int margin = harris_halo + std::max( Settings.WindowSize.width, Settings.WindowSize.height ) / 2;
+
+	const int points_per_patch = Settings.PointsPerPatch;
+	const cv::Matx<float, 3, 3> inverse_homography = Homography.inv();
+	const cv::Rect frame_bounds(0, 0, gray_frame.cols, gray_frame.rows);
+	std::vector<cv::Rect>& dead_patches = Buffers.DeadPatches;
+	std::vector<int>& dead_patch_indices = Buffers.DeadPatchIndices;
+	dead_patches.clear();
+	dead_patch_indices.clear();
+	for (size_t p = 0; p < Reference.PatchRects.size(); ++p) {
+		bool is_dead = true;
+		for (int k = 0; k < points_per_patch; ++k) is_dead &= Reference.Patches.Reliability[p * points_per_patch + k] < 0.5f;
+		if (!is_dead) continue;
+
+		const uint frames_since_reseed = Statistics.FrameNum - Reference.ReseedFrames[p];
+		uint& wait = Reference.ReseedWaits[p];
+		if (wait > 0 && frames_since_reseed < wait) continue;
+
+		// the patch is re-seeded only when the current frame covers it and its margin entirely.
+		const cv::Rect region = cv::Rect(
+			Reference.PatchRects[p].x - margin, Reference.PatchRects[p].y - margin,
+			Reference.PatchRects[p].width + 2 * margin, Reference.PatchRects[p].height + 2 * margin
+		) & cv::Rect(0, 0, Reference.GrayFrame.cols, Reference.GrayFrame.rows);
+		const cv::Point2f corners[4] = {
+			cv::Point2f(static_cast<float>(region.x), static_cast<float>(region.y)),
+			cv::Point2f(static_cast<float>(region.br().x), static_cast<float>(region.y)),
+			cv::Point2f(static_cast<float>(region.x), static_cast<float>(region.br().y)),
+			cv::Point2f(static_cast<float>(region.br().x), static_cast<float>(region.br().y))
+		};
+		bool is_covered = true;
+		for (const auto& corner : corners) {
+			const cv::Point3f mapped = inverse_homography * cv::Point3f(corner.x, corner.y, 1.0f);
+			is_covered &= mapped.z > 0.0f && cv::Point2f(mapped.x / mapped.z, mapped.y / mapped.z).inside( frame_bounds );
 		}
+		if (!is_covered) continue;
+
+		// a patch that dies again soon after its re-seed is likely textureless, so it waits twice as long next time.
+		const bool is_dying_again = wait > 0 && frames_since_reseed < 2 * wait;
+		wait = is_dying_again ? std::min( 2 * wait, 16 * Settings.ReseedInterval ) : Settings.ReseedInterval;
+		Reference.ReseedFrames[p] = Statistics.FrameNum;
+		dead_patches.emplace_back( Reference.PatchRects[p] );
+		dead_patch_indices.emplace_back( static_cast<int>(p) );
 	}
+	if (dead_patches.empty()) return;
+
+	// the reference content of a dead patch and its margin is replaced by the current frame mapped back to the
+	// reference. the margin overlaps the neighboring patches, where the mapped frame agrees with the old content up to
+	// the estimation error.
+	for (const auto& patch : dead_patches) {
+		const cv::Rect region = cv::Rect(
+			patch.x - margin, patch.y - margin, patch.width + 2 * margin, patch.height + 2 * margin
+		) & cv::Rect(0, 0, Reference.GrayFrame.cols, Reference.GrayFrame.rows);
+		const cv::Matx<float, 3, 3> to_region(
+			1.0f, 0.0f, -static_cast<float>(region.x),
+			0.0f, 1.0f, -static_cast<float>(region.y),
+			0.0f, 0.0f, 1.0f
+		);
+		cv::warpPerspective( gray_frame, Buffers.PatchFrame, to_region * Homography, region.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE );
+		Buffers.PatchFrame.copyTo( Reference.GrayFrame(region) );
+		Buffers.PatchFrame.copyTo( Reference.Pyramid[0](region) );
+		updateReferenceRegion( region );
+	}
+
+	std::vector<HarrisPoint>& selected = Buffers.SelectedPoints;
+	PatchSelector.select( selected, Reference.GrayFrame, dead_patches, points_per_patch );
 
-	IsValid.resize( ReferencePoints.size(), true );
-	Reliability.resize( ReferencePoints.size(), 1.0 );
+	std::vector<int>& point_indices = Buffers.ReseededPointIndices;
+	point_indices.clear();
+	for (size_t i = 0; i < dead_patch_indices.size(); ++i) {
+		for (int k = 0; k < points_per_patch; ++k) {
+			const int index = dead_patch_indices[i] * points_per_patch + k;
+			Reference.Patches.setPatch( index, selected[i * points_per_patch + k] );
+		}
+	}
+	if (Settings.TrackerType == TRACKER_TYPE::INVERSE_COMPOSITIONAL) {
+		// the templates of the neighboring points whose windows reach into a margin are refreshed as well.
+		const int half_window = std::max( Settings.WindowSize.width, Settings.WindowSize.height ) / 2;
+		for (size_t i = 0; i < Reference.Patches.size(); ++i) {
+			const cv::Point2f& point = Reference.Patches.ReferencePoints[i];
+			for (const auto& patch : dead_patches) {
+				const cv::Rect_<float> reach(
+					static_cast<float>(patch.x - margin - half_window), static_cast<float>(patch.y - margin - half_window),
+					static_cast<float>(patch.width + 2 * (margin + half_window)), static_cast<float>(patch.height + 2 * (margin + half_window))
+				);
+				if (reach.contains( point )) {
+					point_indices.emplace_back( static_cast<int>(i) );
+					break;
+				}
+			}
+		}
+		Reference.InverseCompositional.update( Reference.Pyramid, Reference.Patches.ReferencePoints, point_indices );
+	}
+	Statistics.ReseededPatchNum += static_cast<uint>(dead_patches.size());
 }
 
-void PatchStabilization::updatePointsAndReliability(const cv::Mat& gray_frame)
+void PatchStabilization::trackWithPyramidalLK(
+	std::vector<cv::Point2f>& target_points,
+	std::vector<cv::Point2f>& re_reference_points,
+	std::vector<uchar>& forward_found_matches,
+	std::vector<uchar>& backward_found_matches,
+	const cv::Mat& gray_frame
+)
 {
-	static const int level = 3;
 	static const float min_eigen_threshold = 1e-6f;
-	static const cv::Size window_size(21, 21);
-	std::vector<float> errors;
-
-	std::vector<cv::Point2f> target_points;
-	std::vector<uchar> forward_found_matches;
-	cv::calcOpticalFlowPyrLK( 
-		ReferenceGrayFrame, 
-		gray_frame, 
-		ReferencePoints, 
-		target_points, 
-		forward_found_matches, 
-		errors, 
-		window_size, 
-		level,
-		cv::TermCriteria(), 0, min_eigen_threshold
-	);
+	const int flags = Settings.WarpBeforeTracking ? 0 : cv::OPTFLOW_USE_INITIAL_FLOW;
+	std::vector<float>& errors = Buffers.Errors;
+
+	// the current pyramid is shared by both passes: it is the target of the forward pass and,
+	// with its derivatives, the source of the backward pass.
+	{
+		StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::FORWARD_LK);
+		cv::buildOpticalFlowPyramid( gray_frame, Buffers.Pyramid, Settings.WindowSize, Reference.PyramidLevel, true );
+		cv::calcOpticalFlowPyrLK( 
+			Reference.Pyramid, 
+			Buffers.Pyramid, 
+			Reference.Patches.ReferencePoints, 
+			target_points, 
+			forward_found_matches, 
+			errors, 
+			Settings.WindowSize, 
+			Reference.PyramidLevel,
+			cv::TermCriteria(), flags, min_eigen_threshold
+		);
+	}
 
-	std::vector<cv::Point2f> re_reference_points;
-	std::vector<uchar> backward_found_matches;
+	StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::BACKWARD_LK);
+	if (!Settings.WarpBeforeTracking) cv::perspectiveTransform( target_points, re_reference_points, Homography );
 	cv::calcOpticalFlowPyrLK( 
-		gray_frame, 
-		ReferenceGrayFrame, 
+		Buffers.Pyramid, 
+		Reference.Pyramid, 
 		target_points, 
 		re_reference_points, 
 		backward_found_matches, 
 		errors, 
-		window_size, 
-		level,
-		cv::TermCriteria(), 0, min_eigen_threshold
+		Settings.WindowSize, 
+		Reference.PyramidLevel,
+		cv::TermCriteria(), flags, min_eigen_threshold
 	);
+}
+
+void PatchStabilization::trackWithInverseCompositional(
+	std::vector<cv::Point2f>& target_points,
+	std::vector<cv::Point2f>& re_reference_points,
+	std::vector<uchar>& forward_found_matches,
+	std::vector<uchar>& backward_found_matches,
+	const cv::Mat& gray_frame
+)
+{
+	static const float max_tracking_error = 20.0f;
+	std::vector<float>& errors = Buffers.Errors;
+
+	{
+		StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::FORWARD_LK);
+		cv::buildOpticalFlowPyramid( gray_frame, Buffers.Pyramid, Settings.WindowSize, Reference.PyramidLevel, false );
+		Reference.InverseCompositional.track( target_points, forward_found_matches, errors, Buffers.Pyramid, !Settings.WarpBeforeTracking );
+	}
+
+	// there is no backward pass, so a converged track with a small mean residual is regarded as consistent.
+	StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::BACKWARD_LK);
+	re_reference_points = Reference.Patches.ReferencePoints;
+	backward_found_matches.resize( errors.size() );
+	for (size_t i = 0; i < errors.size(); ++i) {
+		backward_found_matches[i] = errors[i] < max_tracking_error ? 1 : 0;
+	}
+}
+
+void PatchStabilization::updatePointsAndReliability(const cv::Mat& gray_frame)
+{
+	std::vector<cv::Point2f>& target_points = Buffers.TrackedPoints;
+	std::vector<cv::Point2f>& re_reference_points = Buffers.ReReferencePoints;
+	std::vector<uchar>& forward_found_matches = Buffers.ForwardFoundMatches;
+	std::vector<uchar>& backward_found_matches = Buffers.BackwardFoundMatches;
+
+	// without the pre-warp, the accumulated homography predicts where the reference points are in the raw frame,
+	// and the tracked points are mapped back into the stabilized coordinates afterwards.
+	if (!Settings.WarpBeforeTracking) cv::perspectiveTransform( Reference.Patches.ReferencePoints, target_points, Homography.inv() );
+	if (Settings.TrackerType == TRACKER_TYPE::INVERSE_COMPOSITIONAL) {
+		trackWithInverseCompositional( target_points, re_reference_points, forward_found_matches, backward_found_matches, gray_frame );
+	}
+	else trackWithPyramidalLK( target_points, re_reference_points, forward_found_matches, backward_found_matches, gray_frame );
+
+	if (!Settings.WarpBeforeTracking) cv::perspectiveTransform( target_points, target_points, Homography );
+
+	for (size_t i = 0; i < Reference.Patches.size(); ++i) {
+		Reference.Patches.CurrentX[i] = target_points[i].x;
+		Reference.Patches.CurrentY[i] = target_points[i].y;
 
-	CurrentPoints = target_points;
-	for (size_t i = 0; i < CurrentPoints.size(); ++i) {
 		const float reproject_error[2] = {
-			ReferencePoints[i].x - re_reference_points[i].x, 
-			ReferencePoints[i].y - re_reference_points[i].y 
+			Reference.Patches.ReferenceX[i] - re_reference_points[i].x, 
+			Reference.Patches.ReferenceY[i] - re_reference_points[i].y 
 		};
 		const float weighted_error = (
-			HarrisMatrices[i](0, 0) * reproject_error[0] * reproject_error[0] +
-			(HarrisMatrices[i](0, 1) + HarrisMatrices[i](1, 0)) * reproject_error[0] * reproject_error[1] +
-			HarrisMatrices[i](1, 1) * reproject_error[1] * reproject_error[1]
-		) / MaxEigenvalues[i];
-
-		IsValid[i] = 
-			forward_found_matches[i] && backward_found_matches[i] && weighted_error < 1e-1f &&
-			reproject_error[0] * reproject_error[0] + reproject_error[1] * reproject_error[1] < 1E+3f  ;
-		Reliability[i] = 0.95f * Reliability[i];
-		if (IsValid[i]) Reliability[i] += 0.05f;
+			Reference.Patches.HarrisA[i] * reproject_error[0] * reproject_error[0] +
+			2.0f * Reference.Patches.HarrisB[i] * reproject_error[0] * reproject_error[1] +
+			Reference.Patches.HarrisC[i] * reproject_error[1] * reproject_error[1]
+		) / Reference.Patches.MaxEigenvalues[i];
+
+		const auto is_valid = static_cast<uchar>(
+			(Reference.Patches.IsSelected[i] != 0) & (forward_found_matches[i] != 0) & (backward_found_matches[i] != 0) & (weighted_error < 1e-1f) &
+			(reproject_error[0] * reproject_error[0] + reproject_error[1] * reproject_error[1] < 1E+3f)
+		);
+		Reference.Patches.IsValid[i] = is_valid;
+		Reference.Patches.Reliability[i] = 0.95f * Reference.Patches.Reliability[i] + 0.05f * static_cast<float>(is_valid);
 	}
+	Reference.Patches.updateActiveIndices( 0.5f );
+	Statistics.ActivePointNum = static_cast<uint>(Reference.Patches.ActiveIndices.size());
 }
 
-void PatchStabilization::updateHomography(cv::Mat& updated, const cv::Mat& gray_frame)
+bool PatchStabilization::updateHomography(cv::Matx<float, 3, 3>& updated, const cv::Mat& gray_frame)
 {
 	updatePointsAndReliability( gray_frame );
+	return solveHomography( updated );
+}
 
-	cv::Matx<float, 3, 3> estimated_homography = cv::Matx<float, 3, 3>::eye();
-	cv::Matx<float, 8, 1> h = cv::Matx<float, 8, 1>::zeros();
-
-	std::vector<cv::Point2f> reprojected_points;
-	for (uint iter = 0; iter < 50; ++iter) {
-		cv::perspectiveTransform( CurrentPoints, reprojected_points, estimated_homography.inv() );
-		cv::Matx<float, 8, 8> A = cv::Matx<float, 8, 8>::zeros();
-		cv::Matx<float, 8, 1> b = cv::Matx<float, 8, 1>::zeros();
-
-		float sum_weights = 0.0f;
-		for (uint i = 0; i < ReferencePoints.size(); ++i) {
-			if (IsValid[i] && Reliability[i] >= 0.5) {
-				cv::Matx<float, 2, 1> p0 = { ReferencePoints[i].x, ReferencePoints[i].y };
-				cv::Matx<float, 2, 1> p1 = { CurrentPoints[i].x, CurrentPoints[i].y };
-				cv::Matx<float, 2, 1> reproject_error = { 
-					reprojected_points[i].x - ReferencePoints[i].x, 
-					reprojected_points[i].y - ReferencePoints[i].y 
-				};
-		 
-				const float weight = iter == 0 ? 1.0f : 
-					1.0f / (1.0f + sqrt( reproject_error.dot( HarrisMatrices[i] * reproject_error ) )) / (h(6) * p0(0)+ h(7) * p0(1) + 1.0f);
-				const cv::Matx<float, 2, 8> J = {
-					p0(0), p0(1), 1.0f, 0.0f, 0.0f, 0.0f, -p1(0) * p0(0), -p1(0) * p0(1),
-					0.0f, 0.0f, 0.0f, p0(0), p0(1), 1.0f, -p1(1) * p0(0), -p1(1) * p0(1)
-				};
-				b += weight * J.t() * HarrisMatrices[i] * (p1 - p0);
-				A += weight * J.t() * HarrisMatrices[i] * J;
-				sum_weights += weight;
-			}
-		}
+bool PatchStabilization::solveHomography(cv::Matx<float, 3, 3>& updated)
+{
+	StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::IRLS);
+	// the residual motion changes little between frames, so the solve starts from the previous frame's estimate.
+	cv::Matx<float, 8, 1> h = IsWarmStarted ? PreviousParameters : cv::Matx<float, 8, 1>::zeros();
+	cv::Matx<float, 3, 3> estimated_homography = {
+		1.0f + h(0), h(1), h(2),
+		h(3), 1.0f + h(4), h(5),
+		h(6), h(7), 1.0f 
+	};
+
+	Accumulator.setPoints( Reference.Patches );
+
+	uint iter = 0;
+	bool converged = false;
+	for (; iter < Settings.MaxIterationNum && !converged; ++iter) {
+		cv::Matx<float, 8, 8> A;
+		cv::Matx<float, 8, 1> b;
+		const float sum_weights = Accumulator.accumulate( A, b, estimated_homography.inv(), h, iter > 0 || IsWarmStarted );
+		if (sum_weights <= 0.0f) break;
 
 		A *= 1.0f / sum_weights;
 		b *= 1.0f / sum_weights;
+		const cv::Matx<float, 8, 1> previous_h = h;
 		cv::solve( A, b, h, cv::DECOMP_CHOLESKY );
+		converged = cv::norm( h - previous_h ) < Settings.ConvergenceThreshold;
 
 		estimated_homography = {
 			1.0f + h(0), h(1), h(2),
@@ -178,28 +482,163 @@ void PatchStabilization::updateHomography(cv::Mat& updated, const cv::Mat& gray_
 		};
 	}
 
-	updated = cv::Mat(estimated_homography.inv());
+	Statistics.IterationNum = iter;
+	Statistics.TotalIterationNum += iter;
+	Statistics.IsConverged = converged;
+	if (Statistics.IsConverged) Statistics.ConvergedFrameNum++;
+
+	if (iter == 0) {
+		IsWarmStarted = false;
+		Statistics.MeanResidual = 0.0f;
+		return false;
+	}
+
+	// in pixels of the motion resolution, over the points that took part in the estimation.
+	Statistics.MeanResidual = Accumulator.getMeanResidual( estimated_homography.inv() );
+
+	PreviousParameters = h;
+	IsWarmStarted = true;
+	updated = estimated_homography.inv();
+	return true;
 }
 
-void PatchStabilization::stabilize(cv::Mat& stabilized, const cv::Mat& frame)
+void PatchStabilization::estimateHomography(const cv::Mat& frame)
 {
-	cv::Mat gray_frame;
-	cv::cvtColor( frame, gray_frame, cv::COLOR_BGR2GRAY );
+	const auto start = std::chrono::steady_clock::now();
+	// a gray frame, such as the Y plane of a YUV frame, is tracked as it is without a copy.
+	const bool is_gray = frame.type() == CV_8UC1;
+	const cv::Mat& full_gray_frame = is_gray ? frame : Buffers.GrayFrame;
+	const cv::Mat& gray_frame = Settings.MotionScale > 1 ? Buffers.MotionFrame : full_gray_frame;
+	{
+		StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::COLOR_CONVERSION);
+		if (!is_gray) cv::cvtColor( frame, Buffers.GrayFrame, cv::COLOR_BGR2GRAY );
+		if (Settings.MotionScale > 1) {
+			cv::resize( full_gray_frame, Buffers.MotionFrame, Buffers.MotionFrame.size(), 0.0, 0.0, cv::INTER_AREA );
+		}
+	}
 
-	if (ReferenceGrayFrame.empty()) initialize( gray_frame );
+	if (Reference.GrayFrame.empty()) {
+		StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::INITIALIZATION);
+		initialize( gray_frame );
+	}
+	if (KeyframeTask.valid() && KeyframeTask.wait_for( std::chrono::seconds(0) ) == std::future_status::ready) {
+		KeyframeTask.get();
+		if (!IsNextKeyframeDiscarded) installNextKeyframe();
+	}
 
-	cv::warpPerspective( gray_frame, gray_frame, Homography, gray_frame.size() );
+	const cv::Mat& tracked_frame = Settings.WarpBeforeTracking ? Buffers.TrackedFrame : gray_frame;
+	if (Settings.WarpBeforeTracking) {
+		StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::PRE_WARP);
+		cv::warpPerspective( gray_frame, Buffers.TrackedFrame, Homography, gray_frame.size() );
+	}
 
-	cv::Mat updated_homography;
-	updateHomography( updated_homography, gray_frame );
+	cv::Matx<float, 3, 3> updated_homography;
+	const bool is_updated = updateHomography( updated_homography, tracked_frame );
 
-	if (updated_homography.empty()) {
-		Homography = cv::Mat::eye(3, 3, CV_32FC1);
-		stabilized = frame.clone();
+	Statistics.FrameNum++;
+	Statistics.IsTrackingLost = !is_updated;
+	if (!is_updated) {
+		Homography = cv::Matx<float, 3, 3>::eye();
+		KeyframeAnchor = cv::Matx<float, 3, 3>::eye();
+		StabilizingHomography = cv::Matx<float, 3, 3>::eye();
+		IsNextKeyframeDiscarded = true;
 		return;
 	}
 
 	Homography = updated_homography * Homography;
+	if (Settings.IsReseeding) reseedDeadPatches( gray_frame );
+	StabilizingHomography = KeyframeAnchor * Homography;
+
+	if (Settings.IsReanchoring && !KeyframeTask.valid() && needsNewKeyframe()) requestKeyframe( gray_frame );
+	if (Settings.IsGridAdaptive) {
+		const std::chrono::duration<double, std::milli> estimation_time = std::chrono::steady_clock::now() - start;
+		adaptGrid( estimation_time.count() );
+	}
+}
+
+void PatchStabilization::estimate(cv::Mat& stabilizing_homography, const cv::Mat& frame)
+{
+	prepareWorkspace( frame.size() );
+	const size_t allocation_num = CountingMatAllocator::getThreadAllocationNum();
+	estimateHomography( frame );
+	Statistics.FrameAllocationNum = static_cast<uint>(CountingMatAllocator::getThreadAllocationNum() - allocation_num);
+	if (Settings.MotionScale == 1) {
+		cv::Mat(StabilizingHomography, false).copyTo( stabilizing_homography );
+		return;
+	}
+
+	// H_full = S^-1 * H * S, where S takes the full resolution to the motion resolution. the area-averaged pixel k
+	// covers the full pixels from k * ratio to (k + 1) * ratio, so the pixel centers are shifted as well. the motion
+	// frame is rounded down, so the ratios are the actual ones of each axis, which differ slightly from MotionScale
+	// when it does not divide the frame size.
+	const float sx = static_cast<float>(frame.cols) / static_cast<float>(Buffers.MotionFrame.cols);
+	const float sy = static_cast<float>(frame.rows) / static_cast<float>(Buffers.MotionFrame.rows);
+	const cv::Matx<float, 3, 3> to_full(
+		sx, 0.0f, 0.5f * (sx - 1.0f),
+		0.0f, sy, 0.5f * (sy - 1.0f),
+		0.0f, 0.0f, 1.0f
+	);
+	const cv::Matx<float, 3, 3> full_homography = to_full * StabilizingHomography * to_full.inv();
+	cv::Mat(full_homography, false).copyTo( stabilizing_homography );
+}
+
+cv::Rect PatchStabilization::getOutputRegion(const cv::Size& frame_size) const
+{
+	const cv::Rect frame_bounds(cv::Point(0, 0), frame_size);
+	const cv::Rect region = Settings.OutputCrop & frame_bounds;
+	return region.empty() ? frame_bounds : region;
+}
+
+void PatchStabilization::warp(cv::Mat& stabilized, const cv::Mat& frame, const cv::Mat& stabilizing_homography)
+{
+	StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::FINAL_WARP);
+	cv::Matx<float, 3, 3> homography;
+	cv::Mat homography_view(homography, false);
+	stabilizing_homography.convertTo( homography_view, CV_32F );
+	PerspectiveWarper::warp( stabilized, frame, homography, getOutputRegion( frame.size() ) );
+}
+
+void PatchStabilization::warpI420(
+	cv::Mat& stabilized,
+	const cv::Mat& frame,
+	const cv::Mat& stabilizing_homography,
+	bool is_chroma_left_sited
+)
+{
+	CV_Assert( frame.type() == CV_8UC1 && frame.isContinuous() && frame.rows % 3 == 0 && frame.cols % 2 == 0 );
+
+	StageProfiler::Scope scope(Profiler, StageProfiler::STAGE::FINAL_WARP);
+	cv::Matx<float, 3, 3> homography;
+	cv::Mat homography_view(homography, false);
+	stabilizing_homography.convertTo( homography_view, CV_32F );
+
+	// the planes are warped separately. a chroma sample covers 2x2 luma samples and is sited at their center, or at
+	// the left of it, so the chroma homography is S * H * S^-1 with S taking luma to chroma coordinates, and its
+	// border is neutral.
+	stabilized.create( frame.size(), CV_8UC1 );
+	const cv::Size luma_size(frame.cols, frame.rows * 2 / 3);
+	const cv::Size chroma_size(luma_size.width / 2, luma_size.height / 2);
+	const size_t luma_area = luma_size.area();
+	const size_t chroma_area = chroma_size.area();
+	cv::Mat stabilized_luma = stabilized.rowRange( 0, luma_size.height );
+	PerspectiveWarper::warp( stabilized_luma, frame.rowRange( 0, luma_size.height ), homography, cv::Rect(cv::Point(0, 0), luma_size) );
+
+	const cv::Matx<float, 3, 3> to_chroma(
+		0.5f, 0.0f, is_chroma_left_sited ? 0.0f : -0.25f,
+		0.0f, 0.5f, -0.25f,
+		0.0f, 0.0f, 1.0f
+	);
+	const cv::Matx<float, 3, 3> chroma_homography = to_chroma * homography * to_chroma.inv();
+	for (size_t plane = 0; plane < 2; ++plane) {
+		const size_t offset = luma_area + plane * chroma_area;
+		const cv::Mat chroma(chroma_size, CV_8UC1, frame.data + offset);
+		cv::Mat stabilized_chroma(chroma_size, CV_8UC1, stabilized.data + offset);
+		PerspectiveWarper::warp( stabilized_chroma, chroma, chroma_homography, cv::Rect(cv::Point(0, 0), chroma_size), 128 );
+	}
+}
 
-	cv::warpPerspective( frame, stabilized, Homography, frame.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT );
-}
\ No newline at end of file
+void PatchStabilization::stabilize(cv::Mat& stabilized, const cv::Mat& frame)
+{
+	estimate( StabilizingHomographyBuffer, frame );
+	warp( stabilized, frame, StabilizingHomographyBuffer );
+}
@@ -10,7 +10,16 @@
 
 #pragma once
 
+#include "CountingMatAllocator.h"
+#include "HarrisPatchSelector.h"
+#include "InverseCompositionalTracker.h"
+#include "NormalEquationAccumulator.h"
+#include "PatchTable.h"
+#include "PerspectiveWarper.h"
+#include "StageProfiler.h"
 #include <opencv2/opencv.hpp>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -21,27 +30,199 @@ using uint = unsigned int;
 class PatchStabilization
 {
 public:
-	PatchStabilization();
+	enum class TRACKER_TYPE { PYRAMIDAL_LK = 0, INVERSE_COMPOSITIONAL };
+
+	struct Config
+	{
+		TRACKER_TYPE TrackerType;
+		bool WarpBeforeTracking;
+		int PatchColNum;
+		int PatchRowNum;
+		int PointsPerPatch;
+		cv::Size WindowSize;
+		int PyramidLevel;
+		uint MaxIterationNum;
+		float ConvergenceThreshold;
+
+		// the motion is estimated on the gray frame shrunk by this factor (1, 2 or 4), and the homography is
+		// conjugated back to the full resolution, so only the final warp runs on every pixel of the frame.
+		int MotionScale;
+
+		// the stabilized output only covers this region of the stabilized frame. an empty rect keeps the whole frame.
+		cv::Rect OutputCrop;
+
+		// a positive lookahead (in frames) makes StabilizationPipeline follow the smoothed camera path instead of
+		// locking every frame to the first one. a non-positive sigma is a third of the lookahead.
+		int SmoothingLookahead;
+		double SmoothingSigma;
+
+		// the adaptive grid shrinks when the mean estimation time exceeds the budget (in milliseconds), and grows when
+		// too few patches are valid while there is time left. the row number follows the initial aspect of the grid.
+		bool IsGridAdaptive;
+		double FrameTimeBudget;
+		float MinValidRatio;
+		int MinPatchColNum;
+		int MaxPatchColNum;
+		uint AdaptationInterval;
+
+		// a patch whose points all became unreliable is re-seeded from the current frame mapped back to the reference.
+		// a patch waits the reseed interval (in frames) after its re-seed, and twice as long each time it dies again
+		// within twice that wait, up to 16 times the interval, so textureless patches are not re-seeded over and over.
+		bool IsReseeding;
+		uint ReseedInterval;
+
+		// a new keyframe is prepared in the background when the current frame overlaps the keyframe less than
+		// the overlap ratio, or when fewer patches than the active ratio take part in the estimation.
+		bool IsReanchoring;
+		float ReanchorOverlapRatio;
+		float ReanchorActiveRatio;
+
+		Config() :
+			TrackerType( TRACKER_TYPE::PYRAMIDAL_LK ), WarpBeforeTracking( true ), PatchColNum( 20 ), PatchRowNum( 15 ),
+			PointsPerPatch( 1 ), WindowSize( 21, 21 ), PyramidLevel( 3 ), MaxIterationNum( 50 ), ConvergenceThreshold( 1e-4f ),
+			MotionScale( 1 ), SmoothingLookahead( 0 ), SmoothingSigma( 0.0 ), IsGridAdaptive( false ), FrameTimeBudget( 33.0 ), MinValidRatio( 0.5f ), MinPatchColNum( 8 ), MaxPatchColNum( 64 ),
+			AdaptationInterval( 30 ), IsReseeding( true ), ReseedInterval( 30 ), IsReanchoring( true ), ReanchorOverlapRatio( 0.6f ),
+			ReanchorActiveRatio( 0.3f ) {}
+	};
+
+	struct Stats
+	{
+		uint FrameNum;
+		uint IterationNum;
+		uint TotalIterationNum;
+		uint ConvergedFrameNum;
+		bool IsConverged;
+		bool IsTrackingLost;
+		float MeanResidual;
+		uint PatchColNum;
+		uint PatchRowNum;
+		uint PointNum;
+		uint ActivePointNum;
+		uint ReseededPatchNum;
+		uint KeyframeNum;
+		uint FrameAllocationNum;
+	};
+
+	explicit PatchStabilization(const Config& config = Config());
 	~PatchStabilization() = default;
 
+	// the region of the stabilized frame that warp() computes, clipped to the frame.
+	[[nodiscard]] cv::Rect getOutputRegion(const cv::Size& frame_size) const;
+
+	// stabilize() is estimate() followed by warp(). the two halves can run on different threads,
+	// as long as the frames are estimated in order. both record their stage timings into the same profiler,
+	// so neither runs concurrently with itself; parallel callers use PerspectiveWarper with getOutputRegion().
+	// warp() writes into stabilized in place when it already has the size of the output region.
+	void estimate(cv::Mat& stabilizing_homography, const cv::Mat& frame);
+	void warp(cv::Mat& stabilized, const cv::Mat& frame, const cv::Mat& stabilizing_homography);
+
+	// estimate() also takes a gray frame, so a planar I420 frame (the Y plane followed by the U and V planes, in a
+	// CV_8UC1 mat of height * 3 / 2 rows) is estimated on its Y plane and warped here plane by plane, always whole.
+	// a chroma sample is centered on its 2x2 luma samples, or left-sited, in line with their left column, as in MPEG-2.
+	void warpI420(
+		cv::Mat& stabilized,
+		const cv::Mat& frame,
+		const cv::Mat& stabilizing_homography,
+		bool is_chroma_left_sited = false
+	);
 	void stabilize(cv::Mat& stabilized, const cv::Mat& frame);
+	[[nodiscard]] const Stats& getStatistics() const { return Statistics; }
+	[[nodiscard]] const StageProfiler& getProfiler() const { return Profiler; }
 
 private:
-	int PatchColNum;
-	int PatchRowNum;
-	cv::Mat Homography;
-	cv::Mat ReferenceGrayFrame;
-
-	std::vector<bool> IsValid;
-	std::vector<float> Reliability;
-	std::vector<float> MaxEigenvalues;
-	std::vector<cv::Point2f> CurrentPoints;
-	std::vector<cv::Point2f> ReferencePoints;
-	std::vector<cv::Matx<float, 2, 2>> HarrisMatrices;
-
-	void setReferencePointsAndEigenvalues(const cv::Rect& patch, int patch_index, const std::vector<cv::Mat>& derivatives);
+	// the microbenchmark drives the private stages one at a time.
+	friend class StageBenchmark;
+
+	// everything that is derived from one reference frame, so the next one can be prepared aside and swapped in.
+	struct Keyframe
+	{
+		cv::Mat GrayFrame;
+		std::vector<cv::Mat> Pyramid;
+		int PyramidLevel;
+		int PatchColNum;
+		int PatchRowNum;
+		std::vector<cv::Rect> PatchRects;
+		std::vector<uint> ReseedFrames;
+		std::vector<uint> ReseedWaits;
+		PatchTable Patches;
+		InverseCompositionalTracker InverseCompositional;
+	};
+
+	// per-frame buffers, allocated for the resolution of the stream on its first frame and reused afterwards.
+	// once CountingMatAllocator is installed, every allocation that estimate() makes on its thread is counted into
+	// Stats::FrameAllocationNum, including the ones inside OpenCV functions, so the count also shows what these
+	// buffers do not cover. otherwise it stays 0.
+	struct Workspace
+	{
+		cv::Size FrameSize;
+		cv::Mat GrayFrame;
+		cv::Mat MotionFrame;
+		cv::Mat TrackedFrame;
+		cv::Mat PatchFrame;
+		std::vector<cv::Mat> Pyramid;
+		std::vector<cv::Point2f> TrackedPoints;
+		std::vector<cv::Point2f> ReReferencePoints;
+		std::vector<uchar> ForwardFoundMatches;
+		std::vector<uchar> BackwardFoundMatches;
+		std::vector<float> Errors;
+		std::vector<cv::Rect> DeadPatches;
+		std::vector<int> DeadPatchIndices;
+		std::vector<int> ReseededPointIndices;
+		std::vector<HarrisPoint> SelectedPoints;
+	};
+
+	Config Settings;
+	cv::Matx<float, 3, 3> Homography;
+	cv::Matx<float, 3, 3> KeyframeAnchor;
+	cv::Matx<float, 3, 3> StabilizingHomography;
+	cv::Mat StabilizingHomographyBuffer;
+	Workspace Buffers;
+	HarrisPatchSelector PatchSelector;
+	Keyframe Reference;
+	bool IsWarmStarted;
+	cv::Matx<float, 8, 1> PreviousParameters;
+	Stats Statistics;
+	StageProfiler Profiler;
+	uint AdaptationFrameNum;
+	double AdaptationTime;
+	double AdaptationValidRatio;
+	NormalEquationAccumulator Accumulator;
+	bool IsNextKeyframeDiscarded;
+	cv::Matx<float, 3, 3> NextKeyframeHomography;
+	Keyframe NextKeyframe;
+	std::future<void> KeyframeTask;
+
+	[[nodiscard]] size_t getMaxPointNum() const;
+	void prepareWorkspace(const cv::Size& frame_size);
+	void selectPatches(Keyframe& keyframe) const;
+	void prepareKeyframe(Keyframe& keyframe, const cv::Mat& gray_frame) const;
+	void updateGridStatistics();
 	void initialize(const cv::Mat& reference_gray_frame);
+	void adaptGrid(double frame_time);
+	[[nodiscard]] bool needsNewKeyframe() const;
+	void requestKeyframe(const cv::Mat& gray_frame);
+	void installNextKeyframe();
+	void updateReferenceRegion(const cv::Rect& region);
+	void reseedDeadPatches(const cv::Mat& gray_frame);
 
+	void trackWithPyramidalLK(
+		std::vector<cv::Point2f>& target_points,
+		std::vector<cv::Point2f>& re_reference_points,
+		std::vector<uchar>& forward_found_matches,
+		std::vector<uchar>& backward_found_matches,
+		const cv::Mat& gray_frame
+	);
+	void trackWithInverseCompositional(
+		std::vector<cv::Point2f>& target_points,
+		std::vector<cv::Point2f>& re_reference_points,
+		std::vector<uchar>& forward_found_matches,
+		std::vector<uchar>& backward_found_matches,
+		const cv::Mat& gray_frame
+	);
 	void updatePointsAndReliability(const cv::Mat& gray_frame);
-	void updateHomography(cv::Mat& updated, const cv::Mat& gray_frame);
+	bool updateHomography(cv::Matx<float, 3, 3>& updated, const cv::Mat& gray_frame);
+
+	// the IRLS part of updateHomography() on the points tracked last.
+	bool solveHomography(cv::Matx<float, 3, 3>& updated);
+	void estimateHomography(const cv::Mat& frame);
 };
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "PatchTable.h"
+
+void PatchTable::resize(size_t size)
+{
+	ReferenceX.resize( size );
+	ReferenceY.resize( size );
+	CurrentX.resize( size );
+	CurrentY.resize( size );
+	HarrisA.resize( size );
+	HarrisB.resize( size );
+	HarrisC.resize( size );
+	MaxEigenvalues.resize( size );
+	Reliability.resize( size );
+	IsValid.resize( size );
+	IsSelected.resize( size );
+	ActiveIndices.resize( size );
+	ReferencePoints.resize( size );
+}
+
+void PatchTable::setPatch(size_t index, const HarrisPoint& harris_point)
+{
+	ReferenceX[index] = CurrentX[index] = harris_point.Point.x;
+	ReferenceY[index] = CurrentY[index] = harris_point.Point.y;
+	HarrisA[index] = harris_point.HarrisMatrix(0, 0);
+	HarrisB[index] = 0.5f * (harris_point.HarrisMatrix(0, 1) + harris_point.HarrisMatrix(1, 0));
+	HarrisC[index] = harris_point.HarrisMatrix(1, 1);
+	MaxEigenvalues[index] = harris_point.MaxEigenvalue;
+	IsSelected[index] = static_cast<uchar>(harris_point.IsSelected);
+	Reliability[index] = harris_point.IsSelected ? 1.0f : 0.0f;
+	IsValid[index] = IsSelected[index];
+	ReferencePoints[index] = harris_point.Point;
+}
+
+void PatchTable::updateActiveIndices(float min_reliability)
+{
+	// every index is written, but the count only advances for active patches, so the compaction has no branch.
+	ActiveIndices.resize( size() );
+	size_t count = 0;
+	for (size_t i = 0; i < size(); ++i) {
+		ActiveIndices[count] = static_cast<int>(i);
+		count += static_cast<size_t>(IsValid[i] & static_cast<uchar>(Reliability[i] >= min_reliability));
+	}
+	ActiveIndices.resize( count );
+}
\ No newline at end of file
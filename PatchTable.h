@@ -0,0 +1,52 @@
+#pragma once
+
+#include "HarrisPatchSelector.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+using uchar = unsigned char;
+
+// cv::fastMalloc returns blocks aligned for the widest SIMD registers, so every column can be loaded with aligned loads.
+template<typename T>
+struct AlignedAllocator
+{
+	using value_type = T;
+
+	AlignedAllocator() = default;
+	template<typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(cv::fastMalloc( n * sizeof( T ) )); }
+	void deallocate(T* p, size_t) { cv::fastFree( p ); }
+
+	template<typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+// Per-patch state as structure-of-arrays. The reference point (x, y), its Harris matrix [a b; b c], the largest
+// eigenvalue and the reliability are separate aligned float columns, and ActiveIndices lists the patches that
+// currently take part in the homography estimation. A slot the selector left empty is never active.
+struct PatchTable
+{
+	template<typename T> using Column = std::vector<T, AlignedAllocator<T>>;
+
+	Column<float> ReferenceX;
+	Column<float> ReferenceY;
+	Column<float> CurrentX;
+	Column<float> CurrentY;
+	Column<float> HarrisA;
+	Column<float> HarrisB;
+	Column<float> HarrisC;
+	Column<float> MaxEigenvalues;
+	Column<float> Reliability;
+	Column<uchar> IsValid;
+	Column<uchar> IsSelected;
+	std::vector<int> ActiveIndices;
+
+	// interleaved copy of the reference column for the trackers, which take point arrays.
+	std::vector<cv::Point2f> ReferencePoints;
+
+	[[nodiscard]] size_t size() const { return ReferenceX.size(); }
+	void resize(size_t size);
+	void setPatch(size_t index, const HarrisPoint& harris_point);
+	void updateActiveIndices(float min_reliability);
+};
\ No newline at end of file
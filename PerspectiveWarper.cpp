@@ -0,0 +1,148 @@
+#include "PerspectiveWarper.h"
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace
+{
+	constexpr int CoordinateBits = 5;
+	constexpr int CoordinateScale = 1 << CoordinateBits;
+	constexpr int WeightRound = 1 << (2 * CoordinateBits - 1);
+
+	// in fixed point, far outside of any frame and small enough to stay in range.
+	constexpr double OutsideCoordinate = 1e6 * CoordinateScale;
+	constexpr double MinW = 1e-9;
+
+	void divide(int& x, int& y, double u, double v, double w)
+	{
+		if (w <= MinW) {
+			x = y = -static_cast<int>(OutsideCoordinate);
+			return;
+		}
+		const double scale = CoordinateScale / w;
+		x = cvRound( std::min( std::max( u * scale, -OutsideCoordinate ), OutsideCoordinate ) );
+		y = cvRound( std::min( std::max( v * scale, -OutsideCoordinate ), OutsideCoordinate ) );
+	}
+}
+
+void PerspectiveWarper::getSourceCoordinates(
+	int* xs,
+	int* ys,
+	const cv::Matx<double, 3, 3>& inverse,
+	const cv::Point& start,
+	int width
+)
+{
+	// (u, v, w) = H^-1 * (x, start.y, 1) is linear in x, and dividing every pixel in double, rounded to
+	// 1/CoordinateScale, picks the same source pixels and weights as warpPerspective does.
+	const double u0 = inverse(0, 1) * start.y + inverse(0, 2);
+	const double v0 = inverse(1, 1) * start.y + inverse(1, 2);
+	const double w0 = inverse(2, 1) * start.y + inverse(2, 2);
+	int i = 0;
+#if CV_SIMD_64F
+	constexpr int lanes = cv::v_float64::nlanes;
+	double lane_offsets[lanes];
+	for (int k = 0; k < lanes; ++k) lane_offsets[k] = static_cast<double>(k);
+	const cv::v_float64 offsets = cv::vx_load( lane_offsets );
+	const cv::v_float64 du = cv::vx_setall_f64( inverse(0, 0) ), vu0 = cv::vx_setall_f64( u0 );
+	const cv::v_float64 dv = cv::vx_setall_f64( inverse(1, 0) ), vv0 = cv::vx_setall_f64( v0 );
+	const cv::v_float64 dw = cv::vx_setall_f64( inverse(2, 0) ), vw0 = cv::vx_setall_f64( w0 );
+	const cv::v_float64 scale = cv::vx_setall_f64( static_cast<double>(CoordinateScale) );
+	const cv::v_float64 lower = cv::vx_setall_f64( -OutsideCoordinate ), upper = cv::vx_setall_f64( OutsideCoordinate );
+	const auto scaled = [&](const cv::v_float64& numerator, const cv::v_float64& reciprocal) {
+		return cv::v_min( cv::v_max( numerator * reciprocal, lower ), upper );
+	};
+	for (; i <= width - 2 * lanes; i += 2 * lanes) {
+		// w is linear in x, so the whole chunk is in front of the horizon when both of its ends are.
+		const double x = static_cast<double>(start.x + i);
+		if (w0 + inverse(2, 0) * x <= MinW || w0 + inverse(2, 0) * (x + 2 * lanes - 1) <= MinW) {
+			for (int k = 0; k < 2 * lanes; ++k) {
+				const double xk = x + k;
+				divide( xs[i + k], ys[i + k], inverse(0, 0) * xk + u0, inverse(1, 0) * xk + v0, inverse(2, 0) * xk + w0 );
+			}
+			continue;
+		}
+
+		const cv::v_float64 x_low = cv::vx_setall_f64( x ) + offsets;
+		const cv::v_float64 x_high = x_low + cv::vx_setall_f64( static_cast<double>(lanes) );
+		const cv::v_float64 r_low = scale / (x_low * dw + vw0), r_high = scale / (x_high * dw + vw0);
+		cv::v_store( xs + i, cv::v_round( scaled( x_low * du + vu0, r_low ), scaled( x_high * du + vu0, r_high ) ) );
+		cv::v_store( ys + i, cv::v_round( scaled( x_low * dv + vv0, r_low ), scaled( x_high * dv + vv0, r_high ) ) );
+	}
+#endif
+	for (; i < width; ++i) {
+		const double x = static_cast<double>(start.x + i);
+		divide( xs[i], ys[i], inverse(0, 0) * x + u0, inverse(1, 0) * x + v0, inverse(2, 0) * x + w0 );
+	}
+}
+
+template<int ChannelNum>
+void PerspectiveWarper::sampleRow(uchar* output_row, const int* xs, const int* ys, const cv::Mat& frame, int width, uchar border_value)
+{
+	const int cols = frame.cols;
+	const int rows = frame.rows;
+	const size_t step = frame.step;
+	for (int i = 0; i < width; ++i) {
+		const int ix = xs[i] >> CoordinateBits;
+		const int iy = ys[i] >> CoordinateBits;
+		const int ax = xs[i] & (CoordinateScale - 1);
+		const int ay = ys[i] & (CoordinateScale - 1);
+		const int w00 = (CoordinateScale - ax) * (CoordinateScale - ay);
+		const int w01 = ax * (CoordinateScale - ay);
+		const int w10 = (CoordinateScale - ax) * ay;
+		const int w11 = ax * ay;
+		uchar* out = output_row + i * ChannelNum;
+		if (static_cast<unsigned>(ix) < static_cast<unsigned>(cols - 1) && static_cast<unsigned>(iy) < static_cast<unsigned>(rows - 1)) {
+			const uchar* p0 = frame.data + iy * step + ix * ChannelNum;
+			const uchar* p1 = p0 + step;
+			for (int c = 0; c < ChannelNum; ++c) {
+				out[c] = static_cast<uchar>(
+					(p0[c] * w00 + p0[c + ChannelNum] * w01 + p1[c] * w10 + p1[c + ChannelNum] * w11 + WeightRound) >> (2 * CoordinateBits)
+				);
+			}
+			continue;
+		}
+
+		// near the border, the neighbors outside of the frame take the border value.
+		for (int c = 0; c < ChannelNum; ++c) out[c] = border_value;
+		if (ix < -1 || iy < -1 || ix >= cols || iy >= rows) continue;
+
+		const int weights[4] = { w00, w01, w10, w11 };
+		int sums[ChannelNum];
+		for (int c = 0; c < ChannelNum; ++c) sums[c] = WeightRound;
+		for (int n = 0; n < 4; ++n) {
+			const int x = ix + (n & 1);
+			const int y = iy + (n >> 1);
+			const bool is_inside = x >= 0 && y >= 0 && x < cols && y < rows;
+			const uchar* p = is_inside ? frame.data + y * step + x * ChannelNum : nullptr;
+			for (int c = 0; c < ChannelNum; ++c) sums[c] += (is_inside ? p[c] : border_value) * weights[n];
+		}
+		for (int c = 0; c < ChannelNum; ++c) out[c] = static_cast<uchar>(sums[c] >> (2 * CoordinateBits));
+	}
+}
+
+void PerspectiveWarper::warp(
+	cv::Mat& output,
+	const cv::Mat& frame,
+	const cv::Matx<float, 3, 3>& homography,
+	const cv::Rect& crop,
+	uchar border_value
+)
+{
+	CV_Assert( (frame.type() == CV_8UC3 || frame.type() == CV_8UC1) && !crop.empty() );
+
+	output.create( crop.size(), frame.type() );
+	const cv::Matx<double, 3, 3> inverse = cv::Matx<double, 3, 3>(homography).inv();
+	cv::parallel_for_(
+		cv::Range(0, crop.height),
+		[&](const cv::Range& range) {
+			cv::AutoBuffer<int, 2048> coordinates(2 * crop.width);
+			int* xs = coordinates.data();
+			int* ys = xs + crop.width;
+			for (int y = range.start; y < range.end; ++y) {
+				getSourceCoordinates( xs, ys, inverse, cv::Point(crop.x, crop.y + y), crop.width );
+				if (frame.channels() == 3) sampleRow<3>( output.ptr<uchar>( y ), xs, ys, frame, crop.width, border_value );
+				else sampleRow<1>( output.ptr<uchar>( y ), xs, ys, frame, crop.width, border_value );
+			}
+		},
+		static_cast<double>((crop.height + BandHeight - 1) / BandHeight)
+	);
+}
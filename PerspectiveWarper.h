@@ -0,0 +1,37 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// Warps a frame by a homography into a caller-owned buffer, computing only the pixels of an output crop.
+// Before the perspective division, the source coordinates along a row are linear in x, so they are advanced
+// incrementally, and the division is vectorized in double and rounded to 1/32 pixel as in warpPerspective. The
+// sampling is bilinear in fixed point with a constant border, as INTER_LINEAR with BORDER_CONSTANT, so the output
+// matches warpPerspective except behind the horizon of the homography, where it is the border rather than a mirror
+// image. The rows are split into bands that run in parallel. Frames are CV_8UC3 or CV_8UC1.
+class PerspectiveWarper
+{
+public:
+	// output(y, x) = frame(H^-1 * (crop.x + x, crop.y + y)). output is created with the crop size only when it does
+	// not have that size and type already, so a view into a larger image is written in place.
+	// every channel of a pixel outside of the frame is border_value.
+	static void warp(
+		cv::Mat& output,
+		const cv::Mat& frame,
+		const cv::Matx<float, 3, 3>& homography,
+		const cv::Rect& crop,
+		uchar border_value = 0
+	);
+
+private:
+	static constexpr int BandHeight = 16;
+
+	static void getSourceCoordinates(
+		int* xs,
+		int* ys,
+		const cv::Matx<double, 3, 3>& inverse,
+		const cv::Point& start,
+		int width
+	);
+	template<int ChannelNum>
+	static void sampleRow(uchar* output_row, const int* xs, const int* ys, const cv::Mat& frame, int width, uchar border_value);
+};
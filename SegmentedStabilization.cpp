@@ -0,0 +1,104 @@
+#include "SegmentedStabilization.h"
+
+SegmentedStabilization::SegmentedStabilization(const PatchStabilization::Config& config, int segment_num, int overlap_frame_num) :
+	Settings( config ), SegmentNum( std::max( segment_num, 1 ) ), OverlapFrameNum( std::max( overlap_frame_num, 1 ) )
+{
+}
+
+void SegmentedStabilization::estimateSegment(Segment& segment, const std::string& video_path)
+{
+	segment.Homographies.clear();
+	cv::VideoCapture capture(video_path);
+	if (!capture.isOpened()) return;
+
+	// a seek that the backend refuses or does not land on the first frame is replaced by decoding up to it, since a
+	// segment that starts on another frame would chain the wrong homographies.
+	if (segment.Begin > 0 &&
+		(!capture.set( cv::CAP_PROP_POS_FRAMES, segment.Begin ) ||
+		 static_cast<int>(capture.get( cv::CAP_PROP_POS_FRAMES )) != segment.Begin)) {
+		if (!capture.open( video_path )) return;
+		for (int i = 0; i < segment.Begin; ++i) {
+			if (!capture.grab()) return;
+		}
+	}
+
+	PatchStabilization stabilizer(Settings);
+	cv::Mat frame, stabilizing_homography;
+	segment.Homographies.reserve( segment.End - segment.Begin );
+	for (int i = segment.Begin; i < segment.End && capture.read( frame ); ++i) {
+		stabilizer.estimate( stabilizing_homography, frame );
+		segment.Homographies.emplace_back( cv::Matx<float, 3, 3>(stabilizing_homography) );
+	}
+	Profiler.merge( stabilizer.getProfiler() );
+}
+
+cv::Matx<double, 3, 3> SegmentedStabilization::getBoundaryTransform(const Segment& previous, const Segment& next)
+{
+	// a frame of the overlap maps to the previous reference by P and to the next one by N, so P * N^-1 takes the next
+	// reference to the previous one. the estimates of all overlapping frames are normalized and averaged.
+	cv::Matx<double, 3, 3> sum = cv::Matx<double, 3, 3>::zeros();
+	int count = 0;
+	const auto previous_end = static_cast<int>(previous.Begin + previous.Homographies.size());
+	const auto next_end = static_cast<int>(next.Begin + next.Homographies.size());
+	for (int i = next.Begin; i < std::min( next.OwnBegin, std::min( previous_end, next_end ) ); ++i) {
+		const cv::Matx<double, 3, 3> transform =
+			previous.Homographies[i - previous.Begin] * next.Homographies[i - next.Begin].inv();
+		if (std::abs( transform(2, 2) ) < 1e-12) continue;
+
+		sum += transform * (1.0 / transform(2, 2));
+		count++;
+	}
+	return count > 0 ? sum * (1.0 / count) : cv::Matx<double, 3, 3>::eye();
+}
+
+bool SegmentedStabilization::estimate(std::vector<cv::Mat>& stabilizing_homographies, const std::string& video_path)
+{
+	cv::VideoCapture capture(video_path);
+	if (!capture.isOpened()) return false;
+	const auto frame_num = static_cast<int>(capture.get( cv::CAP_PROP_FRAME_COUNT ));
+	capture.release();
+	if (frame_num <= 0) return false;
+
+	// the i-th segment owns [OwnBegin, End) and starts earlier by the overlap, which it shares with the previous one.
+	const int segment_num = std::min( SegmentNum, std::max( frame_num / (2 * OverlapFrameNum), 1 ) );
+	std::vector<Segment> segments(segment_num);
+	for (int s = 0; s < segment_num; ++s) {
+		segments[s].OwnBegin = static_cast<int>(static_cast<int64_t>(frame_num) * s / segment_num);
+		segments[s].End = static_cast<int>(static_cast<int64_t>(frame_num) * (s + 1) / segment_num);
+		segments[s].Begin = std::max( segments[s].OwnBegin - (s > 0 ? OverlapFrameNum : 0), 0 );
+	}
+
+	// segments are the unit of parallelism, and cv::setNumThreads is process-wide, as in the batch mode.
+	Profiler.reset();
+	WorkStealingPool pool(std::min( segment_num, static_cast<int>(std::max( std::thread::hardware_concurrency(), 1u )) ));
+	const int cores = std::max( static_cast<int>(std::thread::hardware_concurrency()), 1 );
+	cv::setNumThreads( std::max( cores / pool.getWorkerNum(), 1 ) );
+	pool.run(
+		segments.size(),
+		[this, &segments, &video_path](size_t index, int) { estimateSegment( segments[index], video_path ); }
+	);
+
+	// a short segment would leave a gap in the trajectory, so every segment must have all of its frames. the frame
+	// count of some containers is only an estimate, so the last one may end early, but not before its own frames.
+	stabilizing_homographies.clear();
+	SegmentBegins.clear();
+	for (int s = 0; s < segment_num; ++s) {
+		const auto size = static_cast<int>(segments[s].Homographies.size());
+		const bool is_complete = s + 1 < segment_num ?
+			size == segments[s].End - segments[s].Begin : size > segments[s].OwnBegin - segments[s].Begin;
+		if (!is_complete) return false;
+	}
+
+	cv::Matx<double, 3, 3> chain = cv::Matx<double, 3, 3>::eye();
+	for (int s = 0; s < segment_num; ++s) {
+		const Segment& segment = segments[s];
+		if (s > 0) chain = chain * getBoundaryTransform( segments[s - 1], segment );
+
+		SegmentBegins.emplace_back( segment.OwnBegin );
+		const auto end = static_cast<int>(segment.Begin + segment.Homographies.size());
+		for (int i = segment.OwnBegin; i < end; ++i) {
+			stabilizing_homographies.emplace_back( cv::Mat(cv::Matx<float, 3, 3>(chain * segment.Homographies[i - segment.Begin])) );
+		}
+	}
+	return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "PatchStabilization.h"
+#include "StageProfiler.h"
+#include "WorkStealingPool.h"
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Estimates the stabilizing homographies of one long video in independent time segments.
+// Every segment seeks to its own start and is stabilized against its own reference frame on a worker of the pool.
+// Consecutive segments share overlapping frames, so the transform between their references is measured there
+// and chained from the first segment on, which keeps the trajectory continuous across the boundaries.
+class SegmentedStabilization
+{
+public:
+	SegmentedStabilization(const PatchStabilization::Config& config, int segment_num, int overlap_frame_num);
+	~SegmentedStabilization() = default;
+
+	// the i-th homography maps the i-th frame to the stabilized frame. returns false if the video cannot be read or
+	// a segment misses some of its frames. an exception of a segment is rethrown here, once every segment has stopped.
+	bool estimate(std::vector<cv::Mat>& stabilizing_homographies, const std::string& video_path);
+
+	// the first frame that each segment of the last estimate contributed, where the trajectory is chained.
+	[[nodiscard]] const std::vector<int>& getSegmentBegins() const { return SegmentBegins; }
+
+	// the stage timings of every segment, merged.
+	[[nodiscard]] const StageProfiler& getProfiler() const { return Profiler; }
+
+private:
+	struct Segment
+	{
+		int Begin;
+		int OwnBegin;
+		int End;
+		std::vector<cv::Matx<double, 3, 3>> Homographies;
+	};
+
+	PatchStabilization::Config Settings;
+	int SegmentNum;
+	int OverlapFrameNum;
+	StageProfiler Profiler;
+	std::vector<int> SegmentBegins;
+
+	void estimateSegment(Segment& segment, const std::string& video_path);
+	static cv::Matx<double, 3, 3> getBoundaryTransform(const Segment& previous, const Segment& next);
+};
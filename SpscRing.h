@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+// The capacity is rounded up to a power of two, and the head and tail live on separate cache lines.
+// push() waits while the ring is full, which is how a slow consumer holds back its producer.
+// A waiting side spins for a short while and then sleeps on a condition variable, which the other side signals
+// only when someone sleeps, so an idle stage does not take a core away from the busy ones.
+template<typename T>
+class SpscRing
+{
+public:
+	explicit SpscRing(size_t capacity) :
+		Mask( getCapacity( capacity ) - 1 ), Slots( Mask + 1 ), Head( 0 ), Tail( 0 ), IsClosed( false ), SleeperNum( 0 ) {}
+	~SpscRing() = default;
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	bool tryPush(const T& item)
+	{
+		const size_t tail = Tail.load( std::memory_order_relaxed );
+		if (tail - Head.load( std::memory_order_acquire ) > Mask) return false;
+
+		Slots[tail & Mask] = item;
+		Tail.store( tail + 1, std::memory_order_release );
+		wake();
+		return true;
+	}
+
+	bool tryPop(T& item)
+	{
+		const size_t head = Head.load( std::memory_order_relaxed );
+		if (Tail.load( std::memory_order_acquire ) == head) return false;
+
+		item = Slots[head & Mask];
+		Head.store( head + 1, std::memory_order_release );
+		wake();
+		return true;
+	}
+
+	// returns false without pushing when is_stopped is raised while the ring is full.
+	bool push(const T& item, const std::atomic<bool>& is_stopped)
+	{
+		for (int spin = 0; !tryPush( item ); ++spin) {
+			if (is_stopped.load( std::memory_order_acquire )) return false;
+			if (spin < SpinNum) std::this_thread::yield();
+			else {
+				sleep(
+					[this, &is_stopped]() {
+						return Tail.load( std::memory_order_relaxed ) - Head.load( std::memory_order_acquire ) <= Mask ||
+							is_stopped.load( std::memory_order_acquire );
+					}
+				);
+			}
+		}
+		return true;
+	}
+
+	// returns false when the ring is empty and either the producer closed it or is_stopped is raised.
+	bool pop(T& item, const std::atomic<bool>& is_stopped)
+	{
+		for (int spin = 0; !tryPop( item ); ++spin) {
+			if (is_stopped.load( std::memory_order_acquire )) return false;
+			if (IsClosed.load( std::memory_order_acquire )) return tryPop( item );
+			if (spin < SpinNum) std::this_thread::yield();
+			else {
+				sleep(
+					[this, &is_stopped]() {
+						return Tail.load( std::memory_order_acquire ) != Head.load( std::memory_order_relaxed ) ||
+							IsClosed.load( std::memory_order_acquire ) || is_stopped.load( std::memory_order_acquire );
+					}
+				);
+			}
+		}
+		return true;
+	}
+
+	// called by the producer after its last push.
+	void close()
+	{
+		IsClosed.store( true, std::memory_order_release );
+		wake();
+	}
+
+	// wakes a sleeping side up to check its condition again, for example after the stop flag was raised.
+	void wake()
+	{
+		// pairs with the increment of the sleeper number, so either the sleeper sees the new state or it is seen here.
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if (SleeperNum.load( std::memory_order_relaxed ) == 0) return;
+
+		std::lock_guard<std::mutex> lock(SleepLock);
+		Awakening.notify_all();
+	}
+
+	// empties and reopens the ring. neither side may be using it meanwhile.
+	void reset()
+	{
+		Head.store( 0, std::memory_order_relaxed );
+		Tail.store( 0, std::memory_order_relaxed );
+		IsClosed.store( false, std::memory_order_release );
+	}
+
+private:
+	static constexpr int SpinNum = 64;
+
+	// the timeout only bounds the wait on a stop flag raised without calling wake().
+	template<typename Condition>
+	void sleep(const Condition& is_ready)
+	{
+		std::unique_lock<std::mutex> lock(SleepLock);
+		SleeperNum.fetch_add( 1, std::memory_order_seq_cst );
+		if (!is_ready()) Awakening.wait_for( lock, std::chrono::milliseconds(10) );
+		SleeperNum.fetch_sub( 1, std::memory_order_relaxed );
+	}
+
+	static size_t getCapacity(size_t capacity)
+	{
+		size_t power = 1;
+		while (power < capacity) power <<= 1;
+		return power;
+	}
+
+	const size_t Mask;
+	std::vector<T> Slots;
+	alignas(64) std::atomic<size_t> Head;
+	alignas(64) std::atomic<size_t> Tail;
+	alignas(64) std::atomic<bool> IsClosed;
+	alignas(64) std::atomic<int> SleeperNum;
+	std::mutex SleepLock;
+	std::condition_variable Awakening;
+};
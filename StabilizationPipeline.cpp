@@ -0,0 +1,151 @@
+#include "StabilizationPipeline.h"
+
+StabilizationPipeline::StabilizationPipeline(const PatchStabilization::Config& config, int frame_pool_size, bool is_side_by_side) :
+	Stabilizer( config ), Smoother( config.SmoothingLookahead, config.SmoothingSigma ),
+	DelayedFrames( Smoother.getLookahead() + 1 ), FramePool( std::max( frame_pool_size, 1 ) + Smoother.getLookahead() ), FreeFrames( FramePool.size() ),
+	DecodedFrames( FramePool.size() ), EstimatedFrames( FramePool.size() ), WarpedFrames( FramePool.size() ), IsStopped( false ),
+	IsSideBySide( is_side_by_side )
+{
+}
+
+void StabilizationPipeline::stop()
+{
+	IsStopped = true;
+	FreeFrames.wake();
+	DecodedFrames.wake();
+	EstimatedFrames.wake();
+	WarpedFrames.wake();
+}
+
+void StabilizationPipeline::runStage(const std::function<void()>& stage)
+{
+	// the first exception of any stage is kept for run(), and the other stages are stopped.
+	try {
+		stage();
+	}
+	catch (...) {
+		{
+			std::lock_guard<std::mutex> lock(ExceptionLock);
+			if (!StageException) StageException = std::current_exception();
+		}
+		stop();
+	}
+}
+
+void StabilizationPipeline::prepareCanvas(Frame& frame) const
+{
+	// once the input is a view into the canvas, the source decodes into it in place. it is rebuilt only when the
+	// source had to reallocate the input, for example for a new resolution.
+	const cv::Size size = frame.Input.size();
+	if (frame.Canvas.rows == size.height && frame.Canvas.cols == size.width * 2 && frame.Input.data == frame.Canvas.data) return;
+
+	frame.Canvas.create( size.height, size.width * 2, CV_8UC3 );
+	frame.Canvas.setTo( cv::Scalar::all( 0 ) );
+	const cv::Rect left(0, 0, size.width, size.height);
+	frame.Input.copyTo( frame.Canvas(left) );
+	frame.Input = frame.Canvas(left);
+
+	const cv::Rect region = Stabilizer.getOutputRegion( size );
+	frame.Stabilized = frame.Canvas(cv::Rect(size.width + region.x, region.y, region.width, region.height));
+}
+
+void StabilizationPipeline::decode(const Source& source)
+{
+	int64_t index = 0;
+	Frame* frame;
+	while (FreeFrames.pop( frame, IsStopped )) {
+		if (!source( frame->Input ) || frame->Input.empty()) break;
+		if (IsSideBySide) prepareCanvas( *frame );
+
+		frame->Index = index++;
+		if (!DecodedFrames.push( frame, IsStopped )) break;
+	}
+	DecodedFrames.close();
+}
+
+bool StabilizationPipeline::pushSmoothed(const cv::Matx<float, 3, 3>& smoothed_warp, int64_t index)
+{
+	Frame* frame = DelayedFrames[index % DelayedFrames.size()];
+	cv::Mat(smoothed_warp, false).copyTo( frame->StabilizingHomography );
+	return EstimatedFrames.push( frame, IsStopped );
+}
+
+void StabilizationPipeline::estimate()
+{
+	// the delayed frames are indexed by their frame index, and the smoother emits them in the same order.
+	Smoother.reset();
+	int64_t emitted_num = 0;
+	cv::Matx<float, 3, 3> smoothed_warp;
+	Frame* frame;
+	while (DecodedFrames.pop( frame, IsStopped )) {
+		const auto start = std::chrono::steady_clock::now();
+		Stabilizer.estimate( frame->StabilizingHomography, frame->Input );
+		const std::chrono::duration<double, std::milli> estimation_time = std::chrono::steady_clock::now() - start;
+		frame->EstimationTime = estimation_time.count();
+		frame->IterationNum = Stabilizer.getStatistics().IterationNum;
+		frame->Statistics = Stabilizer.getStatistics();
+		if (Smoother.getLookahead() == 0) {
+			if (!EstimatedFrames.push( frame, IsStopped )) break;
+			continue;
+		}
+
+		DelayedFrames[frame->Index % DelayedFrames.size()] = frame;
+		if (Smoother.push( smoothed_warp, cv::Matx<float, 3, 3>(frame->StabilizingHomography) ) &&
+			!pushSmoothed( smoothed_warp, emitted_num++ )) break;
+	}
+	while (Smoother.getLookahead() > 0 && !IsStopped && Smoother.flush( smoothed_warp )) {
+		if (!pushSmoothed( smoothed_warp, emitted_num++ )) break;
+	}
+	EstimatedFrames.close();
+}
+
+void StabilizationPipeline::warp()
+{
+	Frame* frame;
+	while (EstimatedFrames.pop( frame, IsStopped )) {
+		Stabilizer.warp( frame->Stabilized, frame->Input, frame->StabilizingHomography );
+		if (!WarpedFrames.push( frame, IsStopped )) break;
+	}
+	WarpedFrames.close();
+}
+
+int64_t StabilizationPipeline::run(const Source& source, const Sink& sink)
+{
+	IsStopped = false;
+	StageException = nullptr;
+	FreeFrames.reset();
+	DecodedFrames.reset();
+	EstimatedFrames.reset();
+	WarpedFrames.reset();
+	for (auto& frame : FramePool) FreeFrames.tryPush( &frame );
+
+	std::thread decoder(&StabilizationPipeline::runStage, this, [this, &source]() { decode( source ); });
+	std::thread estimator(&StabilizationPipeline::runStage, this, [this]() { estimate(); });
+	std::thread warper(&StabilizationPipeline::runStage, this, [this]() { warp(); });
+
+	// the threads are joined on every way out, so an exception of the sink does not destroy them joinable.
+	int64_t frame_num = 0;
+	runStage(
+		[this, &sink, &frame_num]() {
+			Frame* frame;
+			while (WarpedFrames.pop( frame, IsStopped )) {
+				frame_num++;
+				const bool to_be_continued = sink( *frame );
+				FreeFrames.push( frame, IsStopped );
+				if (!to_be_continued) break;
+			}
+		}
+	);
+	stop();
+
+	decoder.join();
+	estimator.join();
+	warper.join();
+	if (StageException) std::rethrow_exception( StageException );
+	return frame_num;
+}
+
+int64_t StabilizationPipeline::run(cv::VideoCapture& capture, const Sink& sink)
+{
+	return run( [&capture](cv::Mat& frame) { return capture.read( frame ); }, sink );
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "PatchStabilization.h"
+#include "SpscRing.h"
+#include "TrajectorySmoother.h"
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs decoding, motion estimation, warping and the sink of one video on separate threads.
+// The stages pass pooled frames through SPSC rings in order, and the sink returns every frame to the pool,
+// so the number of frames in flight is bounded by the pool size and a slow stage holds back the decoder.
+// With a smoothing lookahead of N, the estimation stage holds the last N frames until their smoothed warps are known,
+// so the pool grows by N frames and every frame reaches the sink N frames later.
+class StabilizationPipeline
+{
+public:
+	struct Frame
+	{
+		int64_t Index;
+		cv::Mat Input;
+		cv::Mat StabilizingHomography;
+		cv::Mat Stabilized;
+		cv::Mat Canvas;
+		double EstimationTime;
+		uint IterationNum;
+		PatchStabilization::Stats Statistics;
+	};
+
+	// a source fills the frame and returns false at the end of the stream.
+	// a sink runs on the calling thread of run() and returns false to stop the pipeline early.
+	using Source = std::function<bool(cv::Mat& frame)>;
+	using Sink = std::function<bool(const Frame& frame)>;
+
+	// side by side, the input is decoded into the left half of the canvas of its frame and the stabilized output is
+	// warped into the right half, so the canvas is ready to display without copying either of them.
+	explicit StabilizationPipeline(
+		const PatchStabilization::Config& config = PatchStabilization::Config(),
+		int frame_pool_size = 8,
+		bool is_side_by_side = false
+	);
+	~StabilizationPipeline() = default;
+
+	// returns the number of frames delivered to the sink. the stabilizer keeps its keyframe between runs,
+	// so a later run is treated as the continuation of the same video. an exception thrown by the source, a stage or
+	// the sink stops the pipeline and is rethrown here once every thread has been joined.
+	int64_t run(const Source& source, const Sink& sink);
+	int64_t run(cv::VideoCapture& capture, const Sink& sink);
+	[[nodiscard]] const StageProfiler& getProfiler() const { return Stabilizer.getProfiler(); }
+
+private:
+	PatchStabilization Stabilizer;
+	TrajectorySmoother Smoother;
+	std::vector<Frame*> DelayedFrames;
+	std::vector<Frame> FramePool;
+	SpscRing<Frame*> FreeFrames;
+	SpscRing<Frame*> DecodedFrames;
+	SpscRing<Frame*> EstimatedFrames;
+	SpscRing<Frame*> WarpedFrames;
+	std::atomic<bool> IsStopped;
+	bool IsSideBySide;
+	std::mutex ExceptionLock;
+	std::exception_ptr StageException;
+
+	void stop();
+	void runStage(const std::function<void()>& stage);
+	void prepareCanvas(Frame& frame) const;
+	void decode(const Source& source);
+	bool pushSmoothed(const cv::Matx<float, 3, 3>& smoothed_warp, int64_t index);
+	void estimate();
+	void warp();
+};
@@ -0,0 +1,136 @@
+#include "StageProfiler.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	int getHighestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64( &index, value );
+		return static_cast<int>(index);
+#else
+		return 63 - __builtin_clzll( value );
+#endif
+	}
+}
+
+LatencyHistogram::LatencyHistogram() : Counts{}, Count( 0 ), Sum( 0 ), Max( 0 )
+{
+}
+
+int LatencyHistogram::getBucketIndex(uint64_t value)
+{
+	if (value < static_cast<uint64_t>(SubBucketNum)) return static_cast<int>(value);
+
+	// the highest bit selects the power of two, and the next SubBucketBits bits select the bucket within it.
+	const int exponent = getHighestBit( value );
+	const int shift = exponent - SubBucketBits;
+	const auto sub_bucket = static_cast<int>((value >> shift) & (SubBucketNum - 1));
+	return SubBucketNum + shift * SubBucketNum + sub_bucket;
+}
+
+uint64_t LatencyHistogram::getHighestValue(int bucket_index)
+{
+	if (bucket_index < SubBucketNum) return static_cast<uint64_t>(bucket_index);
+
+	const int shift = (bucket_index - SubBucketNum) / SubBucketNum;
+	const int sub_bucket = (bucket_index - SubBucketNum) % SubBucketNum;
+	const uint64_t lowest = static_cast<uint64_t>(SubBucketNum + sub_bucket) << shift;
+	return lowest + ((static_cast<uint64_t>(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+	Counts[getBucketIndex( value )].fetch_add( 1, std::memory_order_relaxed );
+	Count.fetch_add( 1, std::memory_order_relaxed );
+	Sum.fetch_add( value, std::memory_order_relaxed );
+	uint64_t max = Max.load( std::memory_order_relaxed );
+	while (value > max && !Max.compare_exchange_weak( max, value, std::memory_order_relaxed )) {}
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (int i = 0; i < BucketNum; ++i) {
+		const uint64_t count = other.Counts[i].load( std::memory_order_relaxed );
+		if (count > 0) Counts[i].fetch_add( count, std::memory_order_relaxed );
+	}
+	Count.fetch_add( other.getCount(), std::memory_order_relaxed );
+	Sum.fetch_add( other.Sum.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+	const uint64_t value = other.getMax();
+	uint64_t max = Max.load( std::memory_order_relaxed );
+	while (value > max && !Max.compare_exchange_weak( max, value, std::memory_order_relaxed )) {}
+}
+
+void LatencyHistogram::reset()
+{
+	for (auto& count : Counts) count.store( 0, std::memory_order_relaxed );
+	Count.store( 0, std::memory_order_relaxed );
+	Sum.store( 0, std::memory_order_relaxed );
+	Max.store( 0, std::memory_order_relaxed );
+}
+
+double LatencyHistogram::getMean() const
+{
+	const uint64_t count = getCount();
+	return count > 0 ? static_cast<double>(Sum.load( std::memory_order_relaxed )) / static_cast<double>(count) : 0.0;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+	const uint64_t count = getCount();
+	if (count == 0) return 0;
+
+	const auto rank = static_cast<uint64_t>(std::ceil( percentile / 100.0 * static_cast<double>(count) ));
+	uint64_t accumulated = 0;
+	for (int i = 0; i < BucketNum; ++i) {
+		accumulated += Counts[i].load( std::memory_order_relaxed );
+		if (accumulated >= std::max( rank, static_cast<uint64_t>(1) )) return std::min( getHighestValue( i ), getMax() );
+	}
+	return getMax();
+}
+
+void StageProfiler::record(STAGE stage, std::chrono::steady_clock::duration duration)
+{
+	const int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	Histograms[static_cast<int>(stage)].record( static_cast<uint64_t>(std::max( nanoseconds, static_cast<int64_t>(0) )) );
+}
+
+void StageProfiler::merge(const StageProfiler& other)
+{
+	for (size_t i = 0; i < Histograms.size(); ++i) Histograms[i].merge( other.Histograms[i] );
+}
+
+void StageProfiler::reset()
+{
+	for (auto& histogram : Histograms) histogram.reset();
+}
+
+void StageProfiler::writeJson(std::ostream& stream) const
+{
+	static const char* const names[static_cast<int>(STAGE::STAGE_NUM)] = {
+		"color_conversion", "pre_warp", "forward_lk", "backward_lk", "irls", "final_warp", "initialization"
+	};
+	const auto to_microseconds = [](double nanoseconds) { return nanoseconds * 1e-3; };
+
+	const std::ios::fmtflags flags = stream.flags();
+	stream << std::fixed << std::setprecision( 3 ) << "{\n  \"unit\": \"us\",\n  \"stages\": {\n";
+	for (int i = 0; i < static_cast<int>(STAGE::STAGE_NUM); ++i) {
+		const LatencyHistogram& histogram = Histograms[i];
+		stream << "    \"" << names[i] << "\": { "
+			<< "\"count\": " << histogram.getCount()
+			<< ", \"mean\": " << to_microseconds( histogram.getMean() )
+			<< ", \"p50\": " << to_microseconds( static_cast<double>(histogram.getPercentile( 50.0 )) )
+			<< ", \"p95\": " << to_microseconds( static_cast<double>(histogram.getPercentile( 95.0 )) )
+			<< ", \"p99\": " << to_microseconds( static_cast<double>(histogram.getPercentile( 99.0 )) )
+			<< ", \"max\": " << to_microseconds( static_cast<double>(histogram.getMax()) )
+			<< " }" << (i + 1 < static_cast<int>(STAGE::STAGE_NUM) ? ",\n" : "\n");
+	}
+	stream << "  }\n}\n";
+	stream.flags( flags );
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Log-linear histogram of durations in nanoseconds, in the manner of an HDR histogram: values below 32 have their
+// own buckets, and every power of two above is split into 32 buckets, so a reported value is within about 3%.
+// Recording only uses relaxed atomics, so any thread can record without a lock.
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+	~LatencyHistogram() = default;
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	void record(uint64_t value);
+
+	// adds the recorded values of another histogram, as if they had been recorded here.
+	void merge(const LatencyHistogram& other);
+	void reset();
+	[[nodiscard]] uint64_t getCount() const { return Count.load( std::memory_order_relaxed ); }
+	[[nodiscard]] uint64_t getMax() const { return Max.load( std::memory_order_relaxed ); }
+	[[nodiscard]] double getMean() const;
+	[[nodiscard]] uint64_t getPercentile(double percentile) const;
+
+private:
+	static constexpr int SubBucketBits = 5;
+	static constexpr int SubBucketNum = 1 << SubBucketBits;
+	static constexpr int BucketNum = SubBucketNum + (64 - SubBucketBits) * SubBucketNum;
+
+	std::array<std::atomic<uint64_t>, BucketNum> Counts;
+	std::atomic<uint64_t> Count;
+	std::atomic<uint64_t> Sum;
+	std::atomic<uint64_t> Max;
+
+	static int getBucketIndex(uint64_t value);
+	static uint64_t getHighestValue(int bucket_index);
+};
+
+// Times the stages of the stabilization with a monotonic clock into one LatencyHistogram per stage.
+class StageProfiler
+{
+public:
+	enum class STAGE { COLOR_CONVERSION = 0, PRE_WARP, FORWARD_LK, BACKWARD_LK, IRLS, FINAL_WARP, INITIALIZATION, STAGE_NUM };
+
+	// records the time from its construction to its destruction.
+	class Scope
+	{
+	public:
+		Scope(StageProfiler& profiler, STAGE stage) : Profiler( profiler ), Stage( stage ), Start( std::chrono::steady_clock::now() ) {}
+		~Scope() { Profiler.record( Stage, std::chrono::steady_clock::now() - Start ); }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		StageProfiler& Profiler;
+		STAGE Stage;
+		std::chrono::steady_clock::time_point Start;
+	};
+
+	StageProfiler() = default;
+	~StageProfiler() = default;
+
+	void record(STAGE stage, std::chrono::steady_clock::duration duration);
+
+	// the histograms are plain counters, so profilers of concurrent stabilizers can be merged into one report.
+	void merge(const StageProfiler& other);
+	void reset();
+	[[nodiscard]] const LatencyHistogram& getHistogram(STAGE stage) const { return Histograms[static_cast<int>(stage)]; }
+
+	// writes count, mean, p50, p95, p99 and max of every stage in microseconds.
+	void writeJson(std::ostream& stream) const;
+
+private:
+	std::array<LatencyHistogram, static_cast<int>(STAGE::STAGE_NUM)> Histograms;
+};
@@ -0,0 +1,129 @@
+#include "SyntheticMotion.h"
+#include <fstream>
+#include <iomanip>
+
+SyntheticMotion::SyntheticMotion(const Config& config) : Settings( config )
+{
+	Settings.FrameNum = std::max( Settings.FrameNum, 1 );
+	Settings.Zoom = std::max( Settings.Zoom, 1.0 );
+}
+
+void SyntheticMotion::createScene(cv::Mat& scene, const cv::Size& size, uint64 seed)
+{
+	cv::RNG rng(seed);
+	cv::Mat accumulated(size, CV_32FC3, cv::Scalar::all( 0.0 ));
+	for (int scale = 8; scale <= 64; scale *= 2) {
+		cv::Mat noise(std::max( size.height / scale, 2 ), std::max( size.width / scale, 2 ), CV_32FC3);
+		rng.fill( noise, cv::RNG::UNIFORM, 0.0, 255.0 );
+		cv::resize( noise, noise, size, 0.0, 0.0, cv::INTER_CUBIC );
+		accumulated += noise * 0.25;
+	}
+	accumulated.convertTo( scene, CV_8UC3 );
+
+	const int shape_num = std::max( size.area() / 20000, 1 );
+	for (int i = 0; i < shape_num; ++i) {
+		const cv::Point corner(rng.uniform( 0, size.width ), rng.uniform( 0, size.height ));
+		const cv::Size extent(rng.uniform( 8, 64 ), rng.uniform( 8, 64 ));
+		const cv::Scalar color(rng.uniform( 0, 256 ), rng.uniform( 0, 256 ), rng.uniform( 0, 256 ));
+		cv::rectangle( scene, cv::Rect(corner, extent), color, cv::FILLED );
+	}
+}
+
+void SyntheticMotion::generate(
+	std::vector<cv::Mat>& frames,
+	std::vector<cv::Matx<double, 3, 3>>& transforms,
+	const std::vector<cv::Mat>& scenes
+) const
+{
+	CV_Assert( !scenes.empty() );
+
+	cv::RNG rng(Settings.Seed);
+	const cv::Size size = scenes[0].size();
+	const double cx = size.width * 0.5;
+	const double cy = size.height * 0.5;
+	const cv::Matx<double, 3, 3> to_center(1.0, 0.0, -cx, 0.0, 1.0, -cy, 0.0, 0.0, 1.0);
+	const cv::Matx<double, 3, 3> from_center(1.0, 0.0, cx, 0.0, 1.0, cy, 0.0, 0.0, 1.0);
+
+	std::vector<Foreground> foregrounds(Settings.ForegroundNum);
+	for (auto& foreground : foregrounds) {
+		const double width = size.width * rng.uniform( 0.05, 0.12 );
+		const double height = size.height * rng.uniform( 0.05, 0.12 );
+		foreground.Region = cv::Rect2d(rng.uniform( 0.0, size.width - width ), rng.uniform( 0.0, size.height - height ), width, height);
+		foreground.Velocity = cv::Vec2d(rng.uniform( -3.0, 3.0 ), rng.uniform( -3.0, 3.0 ));
+		foreground.Color = cv::Scalar(rng.uniform( 0, 256 ), rng.uniform( 0, 256 ), rng.uniform( 0, 256 ));
+	}
+
+	// every parameter is a damped random walk clamped to its range: tx, ty, rotation, log scale, px, py.
+	const double limits[6] = {
+		Settings.MaxTranslation, Settings.MaxTranslation, Settings.MaxRotation * CV_PI / 180.0,
+		std::log1p( Settings.MaxScale ), Settings.MaxPerspective, Settings.MaxPerspective
+	};
+	double parameters[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+	frames.resize( Settings.FrameNum );
+	transforms.resize( Settings.FrameNum );
+	cv::Mat noise;
+	for (int t = 0; t < Settings.FrameNum; ++t) {
+		if (t > 0) {
+			for (int k = 0; k < 6; ++k) {
+				parameters[k] = std::min( std::max( 0.9 * parameters[k] + rng.gaussian( 0.3 * limits[k] ), -limits[k] ), limits[k] );
+			}
+		}
+
+		// the zoom keeps the borders of the scene out of the frame for the whole range of the jitter.
+		const double scale = Settings.Zoom * std::exp( parameters[3] );
+		const double cos_r = scale * std::cos( parameters[2] );
+		const double sin_r = scale * std::sin( parameters[2] );
+		const cv::Matx<double, 3, 3> jitter(
+			cos_r, -sin_r, parameters[0],
+			sin_r, cos_r, parameters[1],
+			parameters[4], parameters[5], 1.0
+		);
+		transforms[t] = from_center * jitter * to_center;
+
+		cv::warpPerspective( scenes[t % scenes.size()], frames[t], transforms[t], size, cv::INTER_LINEAR, cv::BORDER_REFLECT101 );
+		for (auto& foreground : foregrounds) {
+			cv::rectangle( frames[t], foreground.Region, foreground.Color, cv::FILLED );
+			foreground.Region.x += foreground.Velocity[0];
+			foreground.Region.y += foreground.Velocity[1];
+			if (foreground.Region.x < 0.0 || foreground.Region.br().x > size.width) foreground.Velocity[0] = -foreground.Velocity[0];
+			if (foreground.Region.y < 0.0 || foreground.Region.br().y > size.height) foreground.Velocity[1] = -foreground.Velocity[1];
+		}
+		if (rng.uniform( 0.0, 1.0 ) < Settings.BlurProbability) {
+			const double sigma = rng.uniform( 0.5, 2.0 );
+			cv::GaussianBlur( frames[t], frames[t], cv::Size(), sigma );
+		}
+		if (Settings.NoiseSigma > 0.0) {
+			noise.create( size, CV_16SC3 );
+			rng.fill( noise, cv::RNG::NORMAL, 0.0, Settings.NoiseSigma );
+			cv::add( frames[t], noise, frames[t], cv::noArray(), CV_8UC3 );
+		}
+	}
+}
+
+bool SyntheticMotion::writeTransforms(const std::string& path, const std::vector<cv::Matx<double, 3, 3>>& transforms)
+{
+	std::ofstream file(path);
+	if (!file.is_open()) return false;
+
+	file << std::setprecision( 17 );
+	for (const auto& transform : transforms) {
+		for (int i = 0; i < 9; ++i) file << transform.val[i] << (i < 8 ? ' ' : '\n');
+	}
+	return static_cast<bool>(file);
+}
+
+bool SyntheticMotion::readTransforms(std::vector<cv::Matx<double, 3, 3>>& transforms, const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open()) return false;
+
+	transforms.clear();
+	cv::Matx<double, 3, 3> transform;
+	while (file >> transform.val[0]) {
+		for (int i = 1; i < 9; ++i) file >> transform.val[i];
+		if (!file) return false;
+		transforms.emplace_back( transform );
+	}
+	return !transforms.empty();
+}
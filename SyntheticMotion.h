@@ -0,0 +1,54 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Renders a scene through a shaking camera with a known trajectory, so the output of a stabilizer can be compared with
+// the exact transforms. The camera jitter follows a damped random walk of translation, rotation, scale and perspective,
+// and the frames get sensor noise, occasional blur and foreground objects that move independently of the camera.
+class SyntheticMotion
+{
+public:
+	struct Config
+	{
+		int FrameNum;
+		double Zoom;
+		double MaxTranslation;
+		double MaxRotation;
+		double MaxScale;
+		double MaxPerspective;
+		double NoiseSigma;
+		double BlurProbability;
+		int ForegroundNum;
+		uint64 Seed;
+
+		Config() :
+			FrameNum( 120 ), Zoom( 1.15 ), MaxTranslation( 12.0 ), MaxRotation( 1.5 ), MaxScale( 0.02 ),
+			MaxPerspective( 2e-5 ), NoiseSigma( 2.0 ), BlurProbability( 0.15 ), ForegroundNum( 3 ), Seed( 0x5EED ) {}
+	};
+
+	explicit SyntheticMotion(const Config& config = Config());
+	~SyntheticMotion() = default;
+
+	// blurred noise of several scales with solid shapes on top, so every patch of the frame has corners.
+	static void createScene(cv::Mat& scene, const cv::Size& size, uint64 seed);
+
+	// the t-th frame shows scenes[t % scenes.size()] at the size of the scenes, and the t-th transform maps scene
+	// coordinates to the coordinates of the t-th frame. a still image is one scene, and a clip from a fixed camera is many.
+	void generate(std::vector<cv::Mat>& frames, std::vector<cv::Matx<double, 3, 3>>& transforms, const std::vector<cv::Mat>& scenes) const;
+
+	// one line of nine row-major values per frame.
+	static bool writeTransforms(const std::string& path, const std::vector<cv::Matx<double, 3, 3>>& transforms);
+	static bool readTransforms(std::vector<cv::Matx<double, 3, 3>>& transforms, const std::string& path);
+
+private:
+	struct Foreground
+	{
+		cv::Rect2d Region;
+		cv::Vec2d Velocity;
+		cv::Scalar Color;
+	};
+
+	Config Settings;
+};
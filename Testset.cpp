@@ -0,0 +1,27 @@
+#include "Testset.h"
+#include "ProjectPath.h"
+
+void getTestset(std::vector<std::string>& testset)
+{
+	const std::string video_directory_path = std::string(CMAKE_SOURCE_DIR) + "/samples";
+	testset = {
+		video_directory_path + "/test1.avi",
+		video_directory_path + "/test2.avi",
+		video_directory_path + "/test3.avi"
+	};
+}
+
+bool readAllFrames(std::vector<cv::Mat>& frames, const std::string& video_path)
+{
+	cv::VideoCapture cam(video_path);
+	if (!cam.isOpened()) return false;
+
+	frames.clear();
+	cv::Mat frame;
+	while (true) {
+		cam >> frame;
+		if (frame.empty()) break;
+		frames.emplace_back( frame.clone() );
+	}
+	return !frames.empty();
+}
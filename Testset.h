@@ -0,0 +1,11 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// The sample videos shipped in samples/, shared by the demo and the benchmarks.
+void getTestset(std::vector<std::string>& testset);
+
+// decodes the whole video into memory, so a benchmark measures the stabilization without the decoder.
+bool readAllFrames(std::vector<cv::Mat>& frames, const std::string& video_path);
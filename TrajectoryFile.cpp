@@ -0,0 +1,152 @@
+#include "TrajectoryFile.h"
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+TrajectoryWriter::TrajectoryWriter() : Buffer( 1 << 20 ), Header{}, PreviousKeyframeNum( 0 )
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	close();
+}
+
+bool TrajectoryWriter::open(const std::string& path, const cv::Size& frame_size, double fps)
+{
+	close();
+	File.rdbuf()->pubsetbuf( Buffer.data(), static_cast<std::streamsize>(Buffer.size()) );
+	File.open( path, std::ios::binary | std::ios::trunc );
+	if (!File.is_open()) return false;
+
+	Header = TrajectoryFile::Header{};
+	std::memcpy( Header.Magic, TrajectoryFile::Magic, sizeof( Header.Magic ) );
+	Header.Version = TrajectoryFile::Version;
+	Header.HeaderSize = sizeof( TrajectoryFile::Header );
+	Header.RecordSize = sizeof( TrajectoryFile::Record );
+	Header.Width = frame_size.width;
+	Header.Height = frame_size.height;
+	Header.Fps = fps;
+	PreviousKeyframeNum = 0;
+	File.write( reinterpret_cast<const char*>(&Header), sizeof( Header ) );
+	return static_cast<bool>(File);
+}
+
+bool TrajectoryWriter::write(const cv::Mat& stabilizing_homography, const PatchStabilization::Stats& statistics)
+{
+	if (!File.is_open()) return false;
+
+	TrajectoryFile::Record record{};
+	const cv::Matx<float, 3, 3> homography(stabilizing_homography);
+	std::memcpy( record.Homography, homography.val, sizeof( record.Homography ) );
+	record.ValidPointNum = statistics.ActivePointNum;
+	record.MeanResidual = statistics.MeanResidual;
+	if (statistics.IsConverged) record.Flags |= TrajectoryFile::CONVERGED;
+	if (statistics.IsTrackingLost) record.Flags |= TrajectoryFile::TRACKING_LOST;
+	if (statistics.KeyframeNum != PreviousKeyframeNum) record.Flags |= TrajectoryFile::NEW_KEYFRAME;
+	PreviousKeyframeNum = statistics.KeyframeNum;
+
+	File.write( reinterpret_cast<const char*>(&record), sizeof( record ) );
+	Header.FrameNum++;
+	return static_cast<bool>(File);
+}
+
+bool TrajectoryWriter::close()
+{
+	if (!File.is_open()) return true;
+
+	File.seekp( 0 );
+	File.write( reinterpret_cast<const char*>(&Header), sizeof( Header ) );
+	// close() flushes the buffer, so a failure to write the records may only show up here.
+	File.close();
+	return static_cast<bool>(File);
+}
+
+TrajectoryReader::TrajectoryReader() :
+	Header{}, Records( nullptr ), FrameNum( 0 ), Mapping( nullptr ), MappingSize( 0 )
+#ifdef _WIN32
+	, FileHandle( nullptr ), MappingHandle( nullptr )
+#endif
+{
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+	close();
+}
+
+bool TrajectoryReader::open(const std::string& path)
+{
+	close();
+#ifdef _WIN32
+	FileHandle = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if (FileHandle == INVALID_HANDLE_VALUE) {
+		FileHandle = nullptr;
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx( FileHandle, &file_size ) || file_size.QuadPart < static_cast<LONGLONG>(sizeof( Header ))) {
+		close();
+		return false;
+	}
+	MappingSize = static_cast<size_t>(file_size.QuadPart);
+	MappingHandle = CreateFileMappingA( FileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if (MappingHandle != nullptr) Mapping = MapViewOfFile( MappingHandle, FILE_MAP_READ, 0, 0, 0 );
+#else
+	const int descriptor = ::open( path.c_str(), O_RDONLY );
+	if (descriptor < 0) return false;
+
+	struct stat file_status{};
+	if (fstat( descriptor, &file_status ) != 0 || file_status.st_size < static_cast<off_t>(sizeof( Header ))) {
+		::close( descriptor );
+		return false;
+	}
+	MappingSize = static_cast<size_t>(file_status.st_size);
+	Mapping = mmap( nullptr, MappingSize, PROT_READ, MAP_SHARED, descriptor, 0 );
+	::close( descriptor );
+	if (Mapping == MAP_FAILED) Mapping = nullptr;
+#endif
+	if (Mapping == nullptr) {
+		close();
+		return false;
+	}
+
+	// a file that was not closed has no frame number in its header, so the number of whole records decides.
+	std::memcpy( &Header, Mapping, sizeof( Header ) );
+	if (std::memcmp( Header.Magic, TrajectoryFile::Magic, sizeof( Header.Magic ) ) != 0 ||
+		Header.Version != TrajectoryFile::Version || Header.HeaderSize < sizeof( Header ) ||
+		Header.RecordSize != sizeof( TrajectoryFile::Record ) || Header.HeaderSize > MappingSize) {
+		close();
+		return false;
+	}
+	const size_t record_num = (MappingSize - Header.HeaderSize) / Header.RecordSize;
+	FrameNum = Header.FrameNum > 0 ? std::min( static_cast<size_t>(Header.FrameNum), record_num ) : record_num;
+	Records = reinterpret_cast<const TrajectoryFile::Record*>(static_cast<const char*>(Mapping) + Header.HeaderSize);
+	return true;
+}
+
+void TrajectoryReader::close()
+{
+#ifdef _WIN32
+	if (Mapping != nullptr) UnmapViewOfFile( Mapping );
+	if (MappingHandle != nullptr) CloseHandle( MappingHandle );
+	if (FileHandle != nullptr) CloseHandle( FileHandle );
+	MappingHandle = nullptr;
+	FileHandle = nullptr;
+#else
+	if (Mapping != nullptr) munmap( Mapping, MappingSize );
+#endif
+	Mapping = nullptr;
+	MappingSize = 0;
+	Records = nullptr;
+	FrameNum = 0;
+	Header = TrajectoryFile::Header{};
+}
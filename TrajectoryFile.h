@@ -0,0 +1,93 @@
+#pragma once
+
+#include "PatchStabilization.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary sidecar with the per-frame stabilizing homographies of a video, so it can be rendered again without
+// estimating the motion. A fixed-size header is followed by one fixed-size record per frame, in the byte order of
+// the writing machine, so the reader maps the file and reaches any frame in constant time.
+namespace TrajectoryFile
+{
+	constexpr char Magic[8] = { 'V', 'S', 'T', 'R', 'A', 'J', '\0', '\0' };
+	constexpr uint32_t Version = 1;
+
+	enum FLAGS : uint32_t { CONVERGED = 1u << 0, TRACKING_LOST = 1u << 1, NEW_KEYFRAME = 1u << 2 };
+
+	struct Header
+	{
+		char Magic[8];
+		uint32_t Version;
+		uint32_t HeaderSize;
+		uint32_t RecordSize;
+		int32_t Width;
+		int32_t Height;
+		uint32_t Reserved0;
+		uint64_t FrameNum;
+		double Fps;
+		uint8_t Reserved[16];
+	};
+	static_assert( sizeof( Header ) == 64, "the header layout is part of the format" );
+
+	// the homography maps the frame to the stabilized frame. the valid points are the tracked points that took part in
+	// the estimation (one per patch by default), and the residual is their mean error in pixels of the motion resolution.
+	struct Record
+	{
+		float Homography[9];
+		uint32_t ValidPointNum;
+		float MeanResidual;
+		uint32_t Flags;
+	};
+	static_assert( sizeof( Record ) == 48, "the record layout is part of the format" );
+}
+
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter();
+	~TrajectoryWriter();
+	TrajectoryWriter(const TrajectoryWriter&) = delete;
+	TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+	bool open(const std::string& path, const cv::Size& frame_size, double fps);
+	bool write(const cv::Mat& stabilizing_homography, const PatchStabilization::Stats& statistics);
+
+	// writes the final frame number into the header. a file that is not closed is still readable up to its last record.
+	bool close();
+
+private:
+	std::ofstream File;
+	std::vector<char> Buffer;
+	TrajectoryFile::Header Header;
+	uint PreviousKeyframeNum;
+};
+
+class TrajectoryReader
+{
+public:
+	TrajectoryReader();
+	~TrajectoryReader();
+	TrajectoryReader(const TrajectoryReader&) = delete;
+	TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+	[[nodiscard]] size_t getFrameNum() const { return FrameNum; }
+	[[nodiscard]] cv::Size getFrameSize() const { return { Header.Width, Header.Height }; }
+	[[nodiscard]] double getFps() const { return Header.Fps; }
+	[[nodiscard]] const TrajectoryFile::Record& getRecord(size_t index) const { return Records[index]; }
+	[[nodiscard]] cv::Matx<float, 3, 3> getHomography(size_t index) const { return cv::Matx<float, 3, 3>(Records[index].Homography); }
+
+private:
+	TrajectoryFile::Header Header;
+	const TrajectoryFile::Record* Records;
+	size_t FrameNum;
+	void* Mapping;
+	size_t MappingSize;
+#ifdef _WIN32
+	void* FileHandle;
+	void* MappingHandle;
+#endif
+};
@@ -0,0 +1,78 @@
+#include "TrajectoryRenderer.h"
+#include "PerspectiveWarper.h"
+#include <future>
+
+TrajectoryRenderer::TrajectoryRenderer(const PatchStabilization::Config& config, int batch_frame_num) :
+	Renderer( config ), BatchFrameNum( batch_frame_num > 0 ? batch_frame_num : 2 * std::max( cv::getNumThreads(), 1 ) )
+{
+	for (auto& batch : Batches) {
+		batch.Frames.resize( BatchFrameNum );
+		batch.Stabilized.resize( BatchFrameNum );
+		batch.FrameNum = 0;
+	}
+}
+
+cv::Matx<float, 3, 3> TrajectoryRenderer::rescale(const cv::Matx<float, 3, 3>& homography, const cv::Size& from, const cv::Size& to)
+{
+	if (from == to || from.empty()) return homography;
+
+	// H_to = S * H_from * S^-1, where S scales the pixel centers of the estimated resolution to the rendered one.
+	const double sx = static_cast<double>(to.width) / from.width;
+	const double sy = static_cast<double>(to.height) / from.height;
+	const cv::Matx<double, 3, 3> scale(
+		sx, 0.0, 0.5 * (sx - 1.0),
+		0.0, sy, 0.5 * (sy - 1.0),
+		0.0, 0.0, 1.0
+	);
+	return cv::Matx<float, 3, 3>(scale * cv::Matx<double, 3, 3>(homography) * scale.inv());
+}
+
+int64_t TrajectoryRenderer::render(cv::VideoWriter& writer, const std::string& video_path, const TrajectoryReader& trajectory)
+{
+	cv::VideoCapture capture(video_path);
+	if (!capture.isOpened()) return 0;
+
+	// the frames of a batch are the unit of parallelism, so every warp runs on one thread.
+	const auto frame_num = static_cast<int64_t>(trajectory.getFrameNum());
+	int64_t decoded_num = 0;
+	int64_t written_num = 0;
+	std::future<void> encoding;
+	for (int current = 0; decoded_num < frame_num; current ^= 1) {
+		Batch& batch = Batches[current];
+		const int64_t first = decoded_num;
+		batch.FrameNum = 0;
+		while (batch.FrameNum < BatchFrameNum && decoded_num < frame_num && capture.read( batch.Frames[batch.FrameNum] )) {
+			batch.FrameNum++;
+			decoded_num++;
+		}
+		if (batch.FrameNum == 0) break;
+
+		// the workers call the warper directly, since PatchStabilization::warp() records its time in a profiler
+		// that is not shared safely between threads.
+		const cv::Rect output_region = Renderer.getOutputRegion( batch.Frames[0].size() );
+		cv::parallel_for_(
+			cv::Range(0, batch.FrameNum),
+			[&](const cv::Range& range) {
+				for (int i = range.start; i < range.end; ++i) {
+					const cv::Matx<float, 3, 3> homography =
+						rescale( trajectory.getHomography( first + i ), trajectory.getFrameSize(), batch.Frames[i].size() );
+					PerspectiveWarper::warp( batch.Stabilized[i], batch.Frames[i], homography, output_region );
+				}
+			},
+			static_cast<double>(batch.FrameNum)
+		);
+
+		// the previous batch is encoded while this one is decoded and warped, and its buffers are reused after.
+		if (encoding.valid()) encoding.get();
+		encoding = std::async(
+			std::launch::async,
+			[&writer, &batch]() {
+				for (int i = 0; i < batch.FrameNum; ++i) writer.write( batch.Stabilized[i] );
+			}
+		);
+		written_num += batch.FrameNum;
+		if (batch.FrameNum < BatchFrameNum) break;
+	}
+	if (encoding.valid()) encoding.get();
+	return written_num;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "PatchStabilization.h"
+#include "TrajectoryFile.h"
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Renders a video with the homographies of a stored trajectory, without estimating any motion.
+// The frames are independent once their transforms are known, so they are decoded in batches and the frames of a
+// batch are warped in parallel, while the previous batch is encoded on another thread. A trajectory that was
+// estimated at another resolution is rescaled to the resolution of the video.
+class TrajectoryRenderer
+{
+public:
+	// the batch holds twice as many frames as there are threads when batch_frame_num is not positive.
+	explicit TrajectoryRenderer(const PatchStabilization::Config& config, int batch_frame_num = 0);
+	~TrajectoryRenderer() = default;
+
+	// returns the number of frames written, which is at most the number of frames in the trajectory.
+	int64_t render(cv::VideoWriter& writer, const std::string& video_path, const TrajectoryReader& trajectory);
+	[[nodiscard]] cv::Rect getOutputRegion(const cv::Size& frame_size) const { return Renderer.getOutputRegion( frame_size ); }
+
+private:
+	struct Batch
+	{
+		std::vector<cv::Mat> Frames;
+		std::vector<cv::Mat> Stabilized;
+		int FrameNum;
+	};
+
+	PatchStabilization Renderer;
+	int BatchFrameNum;
+	Batch Batches[2];
+
+	static cv::Matx<float, 3, 3> rescale(const cv::Matx<float, 3, 3>& homography, const cv::Size& from, const cv::Size& to);
+};
@@ -0,0 +1,108 @@
+#include "TrajectorySmoother.h"
+
+TrajectorySmoother::TrajectorySmoother(int lookahead_frame_num, double sigma) :
+	Lookahead( std::max( lookahead_frame_num, 0 ) ), PushedNum( 0 ), EmittedNum( 0 )
+{
+	const size_t window_size = 2 * static_cast<size_t>(Lookahead) + 1;
+	if (sigma <= 0.0) sigma = std::max( Lookahead / 3.0, 1e-3 );
+
+	Weights.resize( window_size );
+	for (int k = -Lookahead; k <= Lookahead; ++k) Weights[k + Lookahead] = std::exp( -0.5 * k * k / (sigma * sigma) );
+	Path.resize( window_size );
+	Homographies.resize( window_size );
+}
+
+void TrajectorySmoother::reset()
+{
+	PushedNum = 0;
+	EmittedNum = 0;
+}
+
+TrajectorySmoother::Motion TrajectorySmoother::decompose(const cv::Matx<double, 3, 3>& homography)
+{
+	// A = s * R(angle) * K, where s * R(angle) is the closest similarity to the affine part A.
+	const cv::Matx<double, 3, 3> h = homography * (1.0 / homography(2, 2));
+	Motion motion{};
+	motion.Tx = h(0, 2);
+	motion.Ty = h(1, 2);
+	motion.H20 = h(2, 0);
+	motion.H21 = h(2, 1);
+	motion.Angle = std::atan2( h(1, 0) - h(0, 1), h(0, 0) + h(1, 1) );
+
+	const cv::Matx<double, 2, 2> affine(h(0, 0), h(0, 1), h(1, 0), h(1, 1));
+	const double scale = std::sqrt( std::max( std::abs( cv::determinant( affine ) ), 1e-12 ) );
+	motion.LogScale = std::log( scale );
+
+	const double c = std::cos( motion.Angle ), s = std::sin( motion.Angle );
+	const cv::Matx<double, 2, 2> inverse_similarity(c / scale, s / scale, -s / scale, c / scale);
+	motion.Remainder = inverse_similarity * affine;
+	return motion;
+}
+
+cv::Matx<double, 3, 3> TrajectorySmoother::compose(const Motion& motion)
+{
+	const double scale = std::exp( motion.LogScale );
+	const double c = std::cos( motion.Angle ), s = std::sin( motion.Angle );
+	const cv::Matx<double, 2, 2> affine = cv::Matx<double, 2, 2>(scale * c, -scale * s, scale * s, scale * c) * motion.Remainder;
+	return {
+		affine(0, 0), affine(0, 1), motion.Tx,
+		affine(1, 0), affine(1, 1), motion.Ty,
+		motion.H20, motion.H21, 1.0
+	};
+}
+
+void TrajectorySmoother::emit(cv::Matx<float, 3, 3>& smoothed_warp)
+{
+	// the window is cut at both ends of the stream, and the weights are normalized over what is left.
+	const auto window_size = static_cast<int64_t>(Path.size());
+	const int64_t t = EmittedNum++;
+	const Motion& center = Path[t % window_size];
+	Motion sum{};
+	double total_weight = 0.0;
+	for (int64_t i = std::max( t - Lookahead, static_cast<int64_t>(0) ); i <= std::min( t + Lookahead, PushedNum - 1 ); ++i) {
+		const Motion& motion = Path[i % window_size];
+		const double weight = Weights[i - t + Lookahead];
+
+		// angles are averaged as differences to the center, so the window never straddles the wrap at pi.
+		const double angle = center.Angle + std::remainder( motion.Angle - center.Angle, 2.0 * CV_PI );
+		sum.Tx += weight * motion.Tx;
+		sum.Ty += weight * motion.Ty;
+		sum.Angle += weight * angle;
+		sum.LogScale += weight * motion.LogScale;
+		sum.Remainder += weight * motion.Remainder;
+		sum.H20 += weight * motion.H20;
+		sum.H21 += weight * motion.H21;
+		total_weight += weight;
+	}
+
+	const double normalizer = 1.0 / total_weight;
+	sum.Tx *= normalizer;
+	sum.Ty *= normalizer;
+	sum.Angle *= normalizer;
+	sum.LogScale *= normalizer;
+	sum.Remainder *= normalizer;
+	sum.H20 *= normalizer;
+	sum.H21 *= normalizer;
+	smoothed_warp = cv::Matx<float, 3, 3>(compose( sum ).inv() * Homographies[t % window_size]);
+}
+
+bool TrajectorySmoother::push(cv::Matx<float, 3, 3>& smoothed_warp, const cv::Matx<float, 3, 3>& stabilizing_homography)
+{
+	// the slot of frame t is reused by frame t + 2N + 1, when frame t left the window of every frame still held.
+	const auto window_size = static_cast<int64_t>(Path.size());
+	Homographies[PushedNum % window_size] = cv::Matx<double, 3, 3>(stabilizing_homography);
+	Path[PushedNum % window_size] = decompose( Homographies[PushedNum % window_size] );
+	PushedNum++;
+	if (PushedNum - EmittedNum <= Lookahead) return false;
+
+	emit( smoothed_warp );
+	return true;
+}
+
+bool TrajectorySmoother::flush(cv::Matx<float, 3, 3>& smoothed_warp)
+{
+	if (EmittedNum == PushedNum) return false;
+
+	emit( smoothed_warp );
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Smooths the camera path online with a windowed gaussian over a fixed lookahead, instead of locking every frame to
+// the first one. The path of a frame is its stabilizing homography C_t, decomposed into translation, rotation,
+// log scale, the remaining 2x2 shear K and the perspective terms, which are averaged over the frames from t - N to
+// t + N. The smoothed warp of the frame is W_t = S_t^-1 * C_t, where S_t is the smoothed path, so intended pans
+// pass through and only the jitter is removed. The parameters live in preallocated rings of 2N + 1 entries, and the
+// warp of a frame is emitted exactly N frames after it was pushed, except at the end of the stream.
+class TrajectorySmoother
+{
+public:
+	// H = [s * R(Angle) * Remainder, (Tx, Ty); (H20, H21), 1], the parameters in which camera paths are smoothed.
+	struct Motion
+	{
+		double Tx;
+		double Ty;
+		double Angle;
+		double LogScale;
+		cv::Matx<double, 2, 2> Remainder;
+		double H20;
+		double H21;
+	};
+
+	// sigma is in frames. a non-positive one becomes a third of the lookahead, so the window covers three sigmas.
+	explicit TrajectorySmoother(int lookahead_frame_num, double sigma = 0.0);
+	~TrajectorySmoother() = default;
+
+	// returns true when the frame pushed lookahead frames before is ready, with its warp.
+	bool push(cv::Matx<float, 3, 3>& smoothed_warp, const cv::Matx<float, 3, 3>& stabilizing_homography);
+
+	// called after the last push, once for every frame still held. returns false when none is left.
+	bool flush(cv::Matx<float, 3, 3>& smoothed_warp);
+
+	void reset();
+	[[nodiscard]] int getLookahead() const { return Lookahead; }
+
+	static Motion decompose(const cv::Matx<double, 3, 3>& homography);
+	static cv::Matx<double, 3, 3> compose(const Motion& motion);
+
+private:
+	int Lookahead;
+	std::vector<double> Weights;
+	std::vector<Motion> Path;
+	std::vector<cv::Matx<double, 3, 3>> Homographies;
+	int64_t PushedNum;
+	int64_t EmittedNum;
+
+	void emit(cv::Matx<float, 3, 3>& smoothed_warp);
+};
@@ -0,0 +1,71 @@
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool(int worker_num) :
+	WorkerNum( worker_num > 0 ? worker_num : std::max( static_cast<int>(std::thread::hardware_concurrency()), 1 ) ),
+	IsStopped( false )
+{
+	Queues.resize( WorkerNum );
+	for (auto& queue : Queues) queue = std::make_unique<WorkQueue>();
+}
+
+bool WorkStealingPool::popOwnTask(size_t& task_index, int worker_index)
+{
+	WorkQueue& queue = *Queues[worker_index];
+	std::lock_guard<std::mutex> lock(queue.Lock);
+	if (queue.Tasks.empty()) return false;
+
+	task_index = queue.Tasks.front();
+	queue.Tasks.pop_front();
+	return true;
+}
+
+bool WorkStealingPool::stealTask(size_t& task_index, int worker_index)
+{
+	for (int i = 1; i < WorkerNum; ++i) {
+		WorkQueue& victim = *Queues[(worker_index + i) % WorkerNum];
+		std::lock_guard<std::mutex> lock(victim.Lock);
+		if (victim.Tasks.empty()) continue;
+
+		task_index = victim.Tasks.back();
+		victim.Tasks.pop_back();
+		return true;
+	}
+	return false;
+}
+
+void WorkStealingPool::run(size_t task_num, const std::function<void(size_t, int)>& task)
+{
+	IsStopped = false;
+	TaskException = nullptr;
+	for (int w = 0; w < WorkerNum; ++w) {
+		const size_t begin = task_num * w / WorkerNum;
+		const size_t end = task_num * (w + 1) / WorkerNum;
+		for (size_t i = begin; i < end; ++i) Queues[w]->Tasks.emplace_back( i );
+	}
+
+	// no task creates new ones, so a worker that finds every queue empty is done.
+	std::vector<std::thread> workers;
+	workers.reserve( WorkerNum );
+	for (int w = 0; w < WorkerNum; ++w) {
+		workers.emplace_back(
+			[this, &task, w]() {
+				size_t task_index;
+				while (!IsStopped && (popOwnTask( task_index, w ) || stealTask( task_index, w ))) {
+					try {
+						task( task_index, w );
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> lock(ExceptionLock);
+						if (!TaskException) TaskException = std::current_exception();
+						IsStopped = true;
+					}
+				}
+			}
+		);
+	}
+	for (auto& worker : workers) worker.join();
+
+	// the tasks left by a stopped run are dropped, so that the next run starts from empty queues.
+	for (auto& queue : Queues) queue->Tasks.clear();
+	if (TaskException) std::rethrow_exception( TaskException );
+}
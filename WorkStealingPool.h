@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a fixed set of independent tasks on a pool of workers. Tasks are dealt out in contiguous blocks,
+// every worker takes its own tasks from the front of its queue, and an idle worker steals from the back of
+// another queue, so workers that drew long tasks are relieved by the ones that finished early.
+class WorkStealingPool
+{
+public:
+	explicit WorkStealingPool(int worker_num = 0);
+	~WorkStealingPool() = default;
+
+	[[nodiscard]] int getWorkerNum() const { return WorkerNum; }
+
+	// calls task(task_index, worker_index) once for every index in [0, task_num) and returns when all are done.
+	// the first exception of a task stops the workers from starting new tasks and is rethrown once all have joined.
+	void run(size_t task_num, const std::function<void(size_t, int)>& task);
+
+private:
+	struct WorkQueue
+	{
+		std::mutex Lock;
+		std::deque<size_t> Tasks;
+	};
+
+	int WorkerNum;
+	std::vector<std::unique_ptr<WorkQueue>> Queues;
+	std::atomic<bool> IsStopped;
+	std::mutex ExceptionLock;
+	std::exception_ptr TaskException;
+
+	bool popOwnTask(size_t& task_index, int worker_index);
+	bool stealTask(size_t& task_index, int worker_index);
+};
@@ -0,0 +1,174 @@
+#include "YuvStream.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace
+{
+	constexpr size_t StreamBufferSize = 1 << 22;
+
+	// stdin and stdout outlive the reader and the writer and are flushed at exit, so their buffers are static.
+	char StandardBuffers[2][StreamBufferSize];
+
+	FILE* openStream(const std::string& path, bool is_reading, bool& is_owner, std::vector<char>& buffer)
+	{
+		is_owner = path != "-";
+		if (is_owner) {
+			FILE* stream = std::fopen( path.c_str(), is_reading ? "rb" : "wb" );
+			if (stream != nullptr) std::setvbuf( stream, buffer.data(), _IOFBF, buffer.size() );
+			return stream;
+		}
+
+		FILE* stream = is_reading ? stdin : stdout;
+#ifdef _WIN32
+		_setmode( _fileno( stream ), _O_BINARY );
+#endif
+		std::setvbuf( stream, StandardBuffers[is_reading ? 0 : 1], _IOFBF, StreamBufferSize );
+		return stream;
+	}
+
+	size_t getI420Size(const cv::Size& frame_size)
+	{
+		return static_cast<size_t>(frame_size.area()) * 3 / 2;
+	}
+}
+
+YuvReader::YuvReader() : File( nullptr ), IsOwner( false ), Buffer( StreamBufferSize ), Fps( 0.0 ), IsChromaLeftSited( false )
+{
+}
+
+YuvReader::~YuvReader()
+{
+	close();
+}
+
+bool YuvReader::open(const std::string& path, const cv::Size& raw_frame_size)
+{
+	close();
+	File = openStream( path, true, IsOwner, Buffer );
+	if (File == nullptr) return false;
+
+	Header.clear();
+	FrameSize = raw_frame_size;
+	Fps = 0.0;
+	IsChromaLeftSited = false;
+	if (raw_frame_size.area() > 0) return raw_frame_size.width % 2 == 0 && raw_frame_size.height % 2 == 0;
+	return parseHeader();
+}
+
+bool YuvReader::readLine(std::string& line)
+{
+	line.clear();
+	int c;
+	while ((c = std::fgetc( File )) != EOF && c != '\n') line.push_back( static_cast<char>(c) );
+	return c == '\n';
+}
+
+bool YuvReader::parseHeader()
+{
+	if (!readLine( Header ) || Header.compare( 0, 10, "YUV4MPEG2 " ) != 0) {
+		Header.clear();
+		return false;
+	}
+
+	// only the tags that matter here are checked. a missing color space tag means 4:2:0 by the format, with the
+	// chroma centered as in C420jpeg and C420paldv, whereas C420mpeg2 sites it at the left.
+	size_t begin = 10;
+	while (begin < Header.size()) {
+		size_t end = Header.find( ' ', begin );
+		if (end == std::string::npos) end = Header.size();
+		const std::string tag = Header.substr( begin, end - begin );
+		if (!tag.empty()) {
+			if (tag[0] == 'W') FrameSize.width = std::atoi( tag.c_str() + 1 );
+			else if (tag[0] == 'H') FrameSize.height = std::atoi( tag.c_str() + 1 );
+			else if (tag[0] == 'F') {
+				int numerator = 0, denominator = 0;
+				if (std::sscanf( tag.c_str() + 1, "%d:%d", &numerator, &denominator ) == 2 && denominator > 0) {
+					Fps = static_cast<double>(numerator) / denominator;
+				}
+			}
+			else if (tag[0] == 'C') {
+				if (tag != "C420" && tag != "C420jpeg" && tag != "C420paldv" && tag != "C420mpeg2") {
+					std::cerr << "unsupported y4m color space: " << tag << "\n";
+					Header.clear();
+					return false;
+				}
+				IsChromaLeftSited = tag == "C420mpeg2";
+			}
+		}
+		begin = end + 1;
+	}
+	const bool is_valid = FrameSize.width > 0 && FrameSize.height > 0 && FrameSize.width % 2 == 0 && FrameSize.height % 2 == 0;
+	if (!is_valid) Header.clear();
+	return is_valid;
+}
+
+bool YuvReader::read(cv::Mat& frame)
+{
+	if (File == nullptr) return false;
+	if (isY4M()) {
+		if (!readLine( FrameLine ) || FrameLine.compare( 0, 5, "FRAME" ) != 0) return false;
+	}
+
+	// create() keeps the buffer of the previous frame, so the frames are read in place.
+	frame.create( FrameSize.height * 3 / 2, FrameSize.width, CV_8UC1 );
+	CV_Assert( frame.isContinuous() );
+	const size_t size = getI420Size( FrameSize );
+	return std::fread( frame.data, 1, size, File ) == size;
+}
+
+void YuvReader::close()
+{
+	if (File != nullptr && IsOwner) std::fclose( File );
+	File = nullptr;
+	IsOwner = false;
+}
+
+YuvWriter::YuvWriter() : File( nullptr ), IsOwner( false ), IsY4M( false ), Buffer( StreamBufferSize )
+{
+}
+
+YuvWriter::~YuvWriter()
+{
+	close();
+}
+
+bool YuvWriter::open(const std::string& path, const cv::Size& frame_size, const std::string& y4m_header)
+{
+	close();
+	File = openStream( path, false, IsOwner, Buffer );
+	if (File == nullptr) return false;
+
+	FrameSize = frame_size;
+	IsY4M = !y4m_header.empty();
+	if (IsY4M) {
+		if (std::fwrite( y4m_header.data(), 1, y4m_header.size(), File ) != y4m_header.size()) return false;
+		if (std::fputc( '\n', File ) == EOF) return false;
+	}
+	return true;
+}
+
+bool YuvWriter::write(const cv::Mat& frame)
+{
+	if (File == nullptr) return false;
+	CV_Assert( frame.type() == CV_8UC1 && frame.isContinuous() );
+	CV_Assert( frame.cols == FrameSize.width && frame.rows == FrameSize.height * 3 / 2 );
+
+	if (IsY4M && std::fputs( "FRAME\n", File ) == EOF) return false;
+	const size_t size = getI420Size( FrameSize );
+	return std::fwrite( frame.data, 1, size, File ) == size;
+}
+
+bool YuvWriter::close()
+{
+	if (File == nullptr) return true;
+	bool is_flushed = std::fflush( File ) == 0;
+	if (IsOwner) is_flushed = std::fclose( File ) == 0 && is_flushed;
+	File = nullptr;
+	IsOwner = false;
+	return is_flushed;
+}
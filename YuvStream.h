@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Planar 8-bit I420 frames streamed from and to files or pipes ("-" for stdin and stdout), either as Y4M with its
+// stream header and FRAME markers, or as raw frames of a size given by the caller. A frame is a single continuous
+// CV_8UC1 mat of height * 3 / 2 rows holding the Y, U and V planes, read into the same buffer every time, and the
+// streams go through large stdio buffers so that a frame costs one read or one write call.
+class YuvReader
+{
+public:
+	YuvReader();
+	~YuvReader();
+	YuvReader(const YuvReader&) = delete;
+	YuvReader& operator=(const YuvReader&) = delete;
+
+	// an empty raw frame size means the stream is Y4M, whose header gives the size.
+	bool open(const std::string& path, const cv::Size& raw_frame_size = cv::Size());
+	bool read(cv::Mat& frame);
+	void close();
+
+	[[nodiscard]] bool isY4M() const { return !Header.empty(); }
+	[[nodiscard]] cv::Size getFrameSize() const { return FrameSize; }
+	[[nodiscard]] double getFps() const { return Fps; }
+	[[nodiscard]] const std::string& getHeader() const { return Header; }
+	[[nodiscard]] bool isChromaLeftSited() const { return IsChromaLeftSited; }
+
+private:
+	FILE* File;
+	bool IsOwner;
+	std::vector<char> Buffer;
+	std::string Header;
+	std::string FrameLine;
+	cv::Size FrameSize;
+	double Fps;
+	bool IsChromaLeftSited;
+
+	bool readLine(std::string& line);
+	bool parseHeader();
+};
+
+class YuvWriter
+{
+public:
+	YuvWriter();
+	~YuvWriter();
+	YuvWriter(const YuvWriter&) = delete;
+	YuvWriter& operator=(const YuvWriter&) = delete;
+
+	// an empty Y4M header writes raw frames.
+	bool open(const std::string& path, const cv::Size& frame_size, const std::string& y4m_header = std::string());
+	bool write(const cv::Mat& frame);
+	bool close();
+
+private:
+	FILE* File;
+	bool IsOwner;
+	bool IsY4M;
+	std::vector<char> Buffer;
+	cv::Size FrameSize;
+};
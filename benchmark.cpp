@@ -0,0 +1,122 @@
+#include "StabilizationPipeline.h"
+#include "Testset.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+void runBenchmark(
+   const std::vector<cv::Mat>& frames,
+   const PatchStabilization::Config& config,
+   const std::string& tracker_name
+)
+{
+   PatchStabilization stabilizer(config);
+   cv::Mat stabilized;
+
+   // the first frame initializes the reference, so it is reported separately from the per-frame cost.
+   auto start = std::chrono::steady_clock::now();
+   stabilizer.stabilize( stabilized, frames[0] );
+   const std::chrono::duration<double, std::milli> initialization_time = std::chrono::steady_clock::now() - start;
+
+   std::vector<double> frame_times;
+   frame_times.reserve( frames.size() );
+   uint max_allocation_num = 0;
+   for (size_t i = 1; i < frames.size(); ++i) {
+      start = std::chrono::steady_clock::now();
+      stabilizer.stabilize( stabilized, frames[i] );
+      const std::chrono::duration<double, std::milli> frame_time = std::chrono::steady_clock::now() - start;
+      frame_times.emplace_back( frame_time.count() );
+
+      // the first tracked frame still sizes the tracking buffers, so the steady state starts after it.
+      if (i > 1) max_allocation_num = std::max( max_allocation_num, stabilizer.getStatistics().FrameAllocationNum );
+   }
+   if (frame_times.empty()) return;
+
+   std::sort( frame_times.begin(), frame_times.end() );
+   double total = 0.0;
+   for (const auto& time : frame_times) total += time;
+   const double mean = total / static_cast<double>(frame_times.size());
+   std::cout << std::fixed << std::setprecision( 3 )
+      << "   " << std::left << std::setw( 40 ) << tracker_name
+      << " init: " << initialization_time.count() << " ms"
+      << ", mean: " << mean << " ms/frame"
+      << ", median: " << frame_times[frame_times.size() / 2] << " ms/frame"
+      << ", fps: " << 1000.0 / mean;
+
+   const PatchStabilization::Stats& statistics = stabilizer.getStatistics();
+   if (statistics.FrameNum > 0) {
+      std::cout << ", IRLS iterations: " << static_cast<double>(statistics.TotalIterationNum) / statistics.FrameNum
+         << "/frame (" << statistics.ConvergedFrameNum << "/" << statistics.FrameNum << " converged)";
+   }
+   std::cout << ", grid: " << statistics.PatchColNum << " x " << statistics.PatchRowNum
+      << ", reseeded patches: " << statistics.ReseededPatchNum
+      << ", keyframes: " << statistics.KeyframeNum;
+#ifdef VIDEOSTAB_COUNT_ALLOCATIONS
+   std::cout << ", max allocations/frame: " << max_allocation_num;
+#else
+   (void)max_allocation_num;
+#endif
+   std::cout << "\n";
+}
+
+void runPipelineBenchmark(const std::vector<cv::Mat>& frames, const PatchStabilization::Config& config, const std::string& tracker_name)
+{
+   // frames are copied from memory by the decoding stage, so the throughput is bounded by the slowest stage.
+   StabilizationPipeline pipeline(config);
+   size_t next = 0;
+   const auto start = std::chrono::steady_clock::now();
+   const int64_t frame_num = pipeline.run(
+      [&frames, &next](cv::Mat& frame) {
+         if (next == frames.size()) return false;
+         frames[next++].copyTo( frame );
+         return true;
+      },
+      [](const StabilizationPipeline::Frame&) { return true; }
+   );
+   const std::chrono::duration<double, std::milli> total_time = std::chrono::steady_clock::now() - start;
+
+   const double mean = total_time.count() / static_cast<double>(std::max( frame_num, static_cast<int64_t>(1) ));
+   std::cout << std::fixed << std::setprecision( 3 )
+      << "   " << std::left << std::setw( 40 ) << tracker_name
+      << " mean: " << mean << " ms/frame"
+      << ", fps: " << 1000.0 / mean << "\n";
+}
+
+int main()
+{
+#ifdef VIDEOSTAB_COUNT_ALLOCATIONS
+   CountingMatAllocator::install();
+#endif
+   std::vector<std::string> testset;
+   getTestset( testset );
+
+   std::vector<cv::Mat> frames;
+   for (const auto& test_data : testset) {
+      if (!readAllFrames( frames, test_data )) continue;
+
+      std::cout << "*** BENCHMARK(" << frames[0].cols << " x " << frames[0].rows << ", " << frames.size() << " frames): "
+         << test_data << "***\n";
+      PatchStabilization::Config config;
+      runBenchmark( frames, config, "pyramidal LK" );
+      config.TrackerType = PatchStabilization::TRACKER_TYPE::INVERSE_COMPOSITIONAL;
+      runBenchmark( frames, config, "inverse compositional" );
+      config.TrackerType = PatchStabilization::TRACKER_TYPE::PYRAMIDAL_LK;
+      config.WarpBeforeTracking = false;
+      runBenchmark( frames, config, "pyramidal LK (unwarped)" );
+      config.TrackerType = PatchStabilization::TRACKER_TYPE::INVERSE_COMPOSITIONAL;
+      runBenchmark( frames, config, "inverse compositional (unwarped)" );
+
+      config = PatchStabilization::Config();
+      config.IsGridAdaptive = true;
+      runBenchmark( frames, config, "pyramidal LK (adaptive grid)" );
+
+      config = PatchStabilization::Config();
+      config.MotionScale = 2;
+      runBenchmark( frames, config, "pyramidal LK (1/2 motion scale)" );
+      config.MotionScale = 4;
+      runBenchmark( frames, config, "pyramidal LK (1/4 motion scale)" );
+
+      runPipelineBenchmark( frames, PatchStabilization::Config(), "pyramidal LK (pipelined)" );
+   }
+   return 0;
+}
\ No newline at end of file
@@ -0,0 +1,521 @@
+#include "OfflineStabilization.h"
+#include "SegmentedStabilization.h"
+#include "StabilizationPipeline.h"
+#include "TrajectoryRenderer.h"
+#include "WorkStealingPool.h"
+#include "YuvStream.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+// headless: nothing from highgui is called here, so it runs on machines without a display.
+const char* const Keys =
+   "{help h        |      | print this message}"
+   "{@input        |      | input video path}"
+   "{@output       |      | output video path}"
+   "{tracker       | lk   | tracking engine: lk (pyramidal LK) or ic (inverse compositional)}"
+   "{scale         | 1    | motion estimation scale: 1, 2 (half resolution) or 4 (quarter resolution)}"
+   "{smooth        | 0    | lookahead in frames of the camera path smoothing (0: lock every frame to the first one)}"
+   "{codec         | mp4v | fourcc of the output video}"
+   "{pool          | 8    | number of frames in flight in the pipeline}"
+   "{batch         |      | text file with one '<input> <output>' pair per line (tab-separated, or quoted), stabilized concurrently}"
+   "{jobs          | 0    | number of files stabilized at once in the batch mode (0: one per core)}"
+   "{segments      | 0    | number of time segments of one video estimated concurrently (0: no segmentation)}"
+   "{offline       |      | estimate the motion in a first pass, optimize the whole camera path, and warp in a second pass}"
+   "{render        |      | warp the input with the homographies of this trajectory sidecar, without estimating the motion}"
+   "{crop          | 0.9  | side of the centered output crop relative to the frame in the offline and render modes}"
+   "{overlap       | 30   | number of frames shared by consecutive segments to stitch them}"
+   "{trajectory    |      | binary sidecar where the stabilizing homography and the tracking state of every frame are written}"
+   "{profile       |      | json file where the latency percentiles of every stage are written at the end}"
+   "{yuv           |      | stream planar I420 frames instead of a video: y4m, or raw with --size, where '-' is stdin or stdout}"
+   "{size          |      | frame size of a raw I420 stream as WxH (a y4m stream carries its own)}";
+
+bool getConfig(PatchStabilization::Config& config, const cv::CommandLineParser& parser)
+{
+   const auto tracker = parser.get<std::string>( "tracker" );
+   if (tracker == "lk") config.TrackerType = PatchStabilization::TRACKER_TYPE::PYRAMIDAL_LK;
+   else if (tracker == "ic") config.TrackerType = PatchStabilization::TRACKER_TYPE::INVERSE_COMPOSITIONAL;
+   else {
+      std::cerr << "unknown tracker: " << tracker << "\n";
+      return false;
+   }
+
+   config.MotionScale = parser.get<int>( "scale" );
+   if (config.MotionScale != 1 && config.MotionScale != 2 && config.MotionScale != 4) {
+      std::cerr << "the motion scale must be 1, 2 or 4: " << config.MotionScale << "\n";
+      return false;
+   }
+   config.SmoothingLookahead = std::max( parser.get<int>( "smooth" ), 0 );
+   return true;
+}
+
+bool writeProfile(const StageProfiler& profiler, const std::string& profile_path)
+{
+   if (profile_path.empty()) return true;
+
+   std::ofstream profile(profile_path);
+   if (!profile.is_open()) {
+      std::cerr << "cannot open the profile: " << profile_path << "\n";
+      return false;
+   }
+   profiler.writeJson( profile );
+   return true;
+}
+
+bool openVideos(
+   cv::VideoCapture& capture,
+   cv::VideoWriter& writer,
+   const std::string& input_path,
+   const std::string& output_path,
+   const std::string& codec,
+   const cv::Size& output_size = cv::Size()
+)
+{
+   if (!capture.open( input_path )) {
+      std::cerr << "cannot open the input: " << input_path << "\n";
+      return false;
+   }
+
+   const int width = static_cast<int>(capture.get( cv::CAP_PROP_FRAME_WIDTH ));
+   const int height = static_cast<int>(capture.get( cv::CAP_PROP_FRAME_HEIGHT ));
+   double fps = capture.get( cv::CAP_PROP_FPS );
+   if (fps <= 0.0) fps = 30.0;
+   const int fourcc = cv::VideoWriter::fourcc( codec[0], codec[1], codec[2], codec[3] );
+   if (!writer.open( output_path, fourcc, fps, output_size.empty() ? cv::Size(width, height) : output_size )) {
+      std::cerr << "cannot open the output: " << output_path << "\n";
+      return false;
+   }
+   return true;
+}
+
+int stabilizeVideo(
+   const std::string& input_path,
+   const std::string& output_path,
+   const std::string& codec,
+   const PatchStabilization::Config& config,
+   int pool_size,
+   const std::string& profile_path,
+   const std::string& trajectory_path
+)
+{
+   cv::VideoCapture capture;
+   cv::VideoWriter writer;
+   if (!openVideos( capture, writer, input_path, output_path, codec )) return 1;
+
+   const int width = static_cast<int>(capture.get( cv::CAP_PROP_FRAME_WIDTH ));
+   const int height = static_cast<int>(capture.get( cv::CAP_PROP_FRAME_HEIGHT ));
+   TrajectoryWriter trajectory;
+   if (!trajectory_path.empty() && !trajectory.open( trajectory_path, cv::Size(width, height), capture.get( cv::CAP_PROP_FPS ) )) {
+      std::cerr << "cannot open the trajectory: " << trajectory_path << "\n";
+      return 1;
+   }
+
+   StabilizationPipeline pipeline(config, pool_size);
+   const auto start = std::chrono::steady_clock::now();
+   const int64_t frame_num = pipeline.run(
+      capture,
+      [&writer, &trajectory, &trajectory_path](const StabilizationPipeline::Frame& frame) {
+         writer.write( frame.Stabilized );
+         if (!trajectory_path.empty()) trajectory.write( frame.StabilizingHomography, frame.Statistics );
+         return true;
+      }
+   );
+   if (!trajectory.close()) {
+      std::cerr << "cannot write the trajectory: " << trajectory_path << "\n";
+      return 1;
+   }
+   const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+
+   std::cout << std::fixed << std::setprecision( 3 )
+      << input_path << " (" << width << " x " << height << ") -> " << output_path << ": "
+      << frame_num << " frames in " << total_time.count() << " s, "
+      << static_cast<double>(frame_num) / std::max( total_time.count(), 1e-9 ) << " fps\n";
+   if (!writeProfile( pipeline.getProfiler(), profile_path )) return 1;
+   return frame_num > 0 ? 0 : 1;
+}
+
+int stabilizeSegmented(
+   const std::string& input_path,
+   const std::string& output_path,
+   const std::string& codec,
+   const PatchStabilization::Config& config,
+   int segment_num,
+   int overlap_frame_num,
+   const std::string& profile_path
+)
+{
+   const auto start = std::chrono::steady_clock::now();
+   std::vector<cv::Mat> stabilizing_homographies;
+   SegmentedStabilization segmented(config, segment_num, overlap_frame_num);
+   if (!segmented.estimate( stabilizing_homographies, input_path )) {
+      std::cerr << "cannot estimate the motion of: " << input_path << "\n";
+      return 1;
+   }
+
+   // every homography is known before the warp, so the camera path is smoothed over all of them in place. a warp
+   // comes out after the homography of its frame was pushed, and the smoother keeps its own copy of that.
+   TrajectorySmoother smoother(config.SmoothingLookahead, config.SmoothingSigma);
+   if (smoother.getLookahead() > 0) {
+      size_t smoothed_num = 0;
+      cv::Matx<float, 3, 3> smoothed_warp;
+      for (size_t i = 0; i < stabilizing_homographies.size(); ++i) {
+         if (smoother.push( smoothed_warp, cv::Matx<float, 3, 3>(stabilizing_homographies[i]) )) {
+            stabilizing_homographies[smoothed_num++] = cv::Mat(smoothed_warp, true);
+         }
+      }
+      while (smoother.flush( smoothed_warp )) stabilizing_homographies[smoothed_num++] = cv::Mat(smoothed_warp, true);
+   }
+   const std::chrono::duration<double> estimation_time = std::chrono::steady_clock::now() - start;
+
+   // the stabilized frames are written in order, so the warp runs on one decoding pass after the estimation.
+   cv::VideoCapture capture;
+   cv::VideoWriter writer;
+   if (!openVideos( capture, writer, input_path, output_path, codec )) return 1;
+
+   // the segments are estimated by their own stabilizers, whose profiles are merged with the one of the final warp.
+   cv::setNumThreads( -1 );
+   PatchStabilization renderer(config);
+   int64_t frame_num = 0;
+   cv::Mat frame, stabilized;
+   while (frame_num < static_cast<int64_t>(stabilizing_homographies.size()) && capture.read( frame )) {
+      renderer.warp( stabilized, frame, stabilizing_homographies[frame_num] );
+      writer.write( stabilized );
+      frame_num++;
+   }
+   const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+
+   std::cout << std::fixed << std::setprecision( 3 )
+      << input_path << " -> " << output_path << ": " << frame_num << " frames in " << total_time.count() << " s"
+      << " (estimation: " << estimation_time.count() << " s), "
+      << static_cast<double>(frame_num) / std::max( total_time.count(), 1e-9 ) << " fps\n";
+   StageProfiler profiler;
+   profiler.merge( segmented.getProfiler() );
+   profiler.merge( renderer.getProfiler() );
+   if (!writeProfile( profiler, profile_path )) return 1;
+   return frame_num > 0 ? 0 : 1;
+}
+
+int stabilizeOffline(
+   const std::string& input_path,
+   const std::string& output_path,
+   const std::string& codec,
+   const PatchStabilization::Config& config,
+   double crop_ratio
+)
+{
+   const auto start = std::chrono::steady_clock::now();
+   OfflineStabilization offline(config, crop_ratio);
+   if (!offline.estimateMotion( input_path )) {
+      std::cerr << "cannot estimate the motion of: " << input_path << "\n";
+      return 1;
+   }
+   const std::chrono::duration<double> estimation_time = std::chrono::steady_clock::now() - start;
+   offline.optimizePath();
+   const std::chrono::duration<double> optimization_time = std::chrono::steady_clock::now() - start - estimation_time;
+
+   cv::VideoCapture capture;
+   cv::VideoWriter writer;
+   if (!openVideos( capture, writer, input_path, output_path, codec, offline.getOutputRegion().size() )) return 1;
+   capture.release();
+
+   const int64_t frame_num = offline.render( writer, input_path );
+   const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+   const auto estimated_num = static_cast<double>(offline.getWarps().size());
+   std::cout << std::fixed << std::setprecision( 3 )
+      << input_path << " -> " << output_path << " (" << offline.getOutputRegion().width << " x " << offline.getOutputRegion().height
+      << "): " << frame_num << " frames in " << total_time.count() << " s"
+      << " (motion pass: " << estimation_time.count() << " s, " << estimated_num / std::max( estimation_time.count(), 1e-9 ) << " fps"
+      << ", path optimization: " << optimization_time.count() << " s), "
+      << static_cast<double>(frame_num) / std::max( total_time.count(), 1e-9 ) << " fps\n";
+   return frame_num > 0 ? 0 : 1;
+}
+
+int renderTrajectory(
+   const std::string& input_path,
+   const std::string& output_path,
+   const std::string& codec,
+   PatchStabilization::Config config,
+   const std::string& trajectory_path,
+   double crop_ratio
+)
+{
+   TrajectoryReader trajectory;
+   if (!trajectory.open( trajectory_path )) {
+      std::cerr << "cannot read the trajectory: " << trajectory_path << "\n";
+      return 1;
+   }
+
+   cv::VideoCapture capture;
+   if (!capture.open( input_path )) {
+      std::cerr << "cannot open the input: " << input_path << "\n";
+      return 1;
+   }
+   const cv::Size frame_size(
+      static_cast<int>(capture.get( cv::CAP_PROP_FRAME_WIDTH )), static_cast<int>(capture.get( cv::CAP_PROP_FRAME_HEIGHT ))
+   );
+   capture.release();
+
+   crop_ratio = std::min( std::max( crop_ratio, 0.1 ), 1.0 );
+   const cv::Size crop_size(cvRound( frame_size.width * crop_ratio ), cvRound( frame_size.height * crop_ratio ));
+   config.OutputCrop = cv::Rect(
+      cv::Point((frame_size.width - crop_size.width) / 2, (frame_size.height - crop_size.height) / 2), crop_size
+   );
+   TrajectoryRenderer renderer(config);
+
+   cv::VideoWriter writer;
+   if (!openVideos( capture, writer, input_path, output_path, codec, renderer.getOutputRegion( frame_size ).size() )) return 1;
+   capture.release();
+
+   const auto start = std::chrono::steady_clock::now();
+   const int64_t frame_num = renderer.render( writer, input_path, trajectory );
+   const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+   std::cout << std::fixed << std::setprecision( 3 )
+      << input_path << " + " << trajectory_path << " (" << trajectory.getFrameNum() << " frames at "
+      << trajectory.getFrameSize().width << " x " << trajectory.getFrameSize().height << ") -> " << output_path << ": "
+      << frame_num << " frames in " << total_time.count() << " s, "
+      << static_cast<double>(frame_num) / std::max( total_time.count(), 1e-9 ) << " fps\n";
+   return frame_num > 0 ? 0 : 1;
+}
+
+// the frames stay in their planar form from the input to the output, and the lookahead of the smoothing is a ring of
+// reused frames, so nothing is allocated per frame. the report goes to stderr as stdout may carry the frames.
+int stabilizeYuv(
+   const std::string& input_path,
+   const std::string& output_path,
+   const PatchStabilization::Config& config,
+   const std::string& raw_size,
+   const std::string& profile_path,
+   const std::string& trajectory_path
+)
+{
+   cv::Size raw_frame_size;
+   if (!raw_size.empty() && std::sscanf( raw_size.c_str(), "%dx%d", &raw_frame_size.width, &raw_frame_size.height ) != 2) {
+      std::cerr << "the size must be WxH: " << raw_size << "\n";
+      return 1;
+   }
+
+   YuvReader reader;
+   if (!reader.open( input_path, raw_frame_size )) {
+      std::cerr << "cannot read an I420 stream with even dimensions from: " << input_path << "\n";
+      return 1;
+   }
+   const cv::Size frame_size = reader.getFrameSize();
+   YuvWriter writer;
+   if (!writer.open( output_path, frame_size, reader.getHeader() )) {
+      std::cerr << "cannot open the output: " << output_path << "\n";
+      return 1;
+   }
+
+   TrajectoryWriter trajectory;
+   if (!trajectory_path.empty() && !trajectory.open( trajectory_path, frame_size, reader.getFps() )) {
+      std::cerr << "cannot open the trajectory: " << trajectory_path << "\n";
+      return 1;
+   }
+
+   // the tracking state of a frame waits in the ring with the frame until its smoothed warp is known.
+   PatchStabilization stabilizer(config);
+   TrajectorySmoother smoother(config.SmoothingLookahead, config.SmoothingSigma);
+   std::vector<cv::Mat> frames(static_cast<size_t>(smoother.getLookahead()) + 1);
+   std::vector<PatchStabilization::Stats> statistics(frames.size());
+   cv::Mat stabilizing_homography, stabilized;
+   cv::Matx<float, 3, 3> smoothed_warp;
+   const cv::Mat smoothed_warp_view(smoothed_warp, false);
+   int64_t read_num = 0, written_num = 0;
+   bool is_written = true, is_trajectory_written = true;
+   const auto write = [&]() {
+      const size_t index = written_num % frames.size();
+      stabilizer.warpI420( stabilized, frames[index], smoothed_warp_view, reader.isChromaLeftSited() );
+      is_written = is_written && writer.write( stabilized );
+      if (!trajectory_path.empty()) is_trajectory_written = trajectory.write( smoothed_warp_view, statistics[index] ) && is_trajectory_written;
+      written_num++;
+   };
+
+   const auto start = std::chrono::steady_clock::now();
+   while (is_written && reader.read( frames[read_num % frames.size()] )) {
+      const cv::Mat& frame = frames[read_num % frames.size()];
+      read_num++;
+      stabilizer.estimate( stabilizing_homography, frame.rowRange( 0, frame_size.height ) );
+      statistics[(read_num - 1) % frames.size()] = stabilizer.getStatistics();
+      if (smoother.getLookahead() == 0) {
+         smoothed_warp = cv::Matx<float, 3, 3>(stabilizing_homography);
+         write();
+      }
+      else if (smoother.push( smoothed_warp, cv::Matx<float, 3, 3>(stabilizing_homography) )) write();
+   }
+   while (is_written && smoother.getLookahead() > 0 && smoother.flush( smoothed_warp )) write();
+   if (!writer.close() || !is_written) {
+      std::cerr << "cannot write the output: " << output_path << "\n";
+      return 1;
+   }
+   if (!trajectory.close() || !is_trajectory_written) {
+      std::cerr << "cannot write the trajectory: " << trajectory_path << "\n";
+      return 1;
+   }
+   const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+
+   std::cerr << std::fixed << std::setprecision( 3 )
+      << input_path << " (" << frame_size.width << " x " << frame_size.height << (reader.isY4M() ? ", y4m" : ", raw")
+      << ") -> " << output_path << ": " << written_num << " frames in " << total_time.count() << " s, "
+      << static_cast<double>(written_num) / std::max( total_time.count(), 1e-9 ) << " fps\n";
+   if (!writeProfile( stabilizer.getProfiler(), profile_path )) return 1;
+   return written_num > 0 ? 0 : 1;
+}
+
+int stabilizeBatch(
+   const std::string& list_path,
+   const std::string& codec,
+   const PatchStabilization::Config& config,
+   int job_num,
+   const std::string& profile_path
+)
+{
+   std::ifstream list(list_path);
+   if (!list.is_open()) {
+      std::cerr << "cannot open the batch list: " << list_path << "\n";
+      return 1;
+   }
+
+   // a line is either '<input>\t<output>', taken verbatim, or two fields separated by spaces, each of which may be
+   // double-quoted to contain spaces.
+   std::vector<std::pair<std::string, std::string>> jobs;
+   std::string line;
+   while (std::getline( list, line )) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      const size_t tab = line.find( '\t' );
+      if (tab != std::string::npos) {
+         if (tab > 0 && tab + 1 < line.size()) jobs.emplace_back( line.substr( 0, tab ), line.substr( tab + 1 ) );
+         continue;
+      }
+
+      std::istringstream fields(line);
+      std::string input_path, output_path;
+      if (fields >> std::quoted( input_path ) >> std::quoted( output_path )) jobs.emplace_back( input_path, output_path );
+   }
+
+   // files are the unit of parallelism here, so every file runs serially on its worker, and opencv gets the cores
+   // left per worker. cv::setNumThreads is process-wide, so this is one setting shared by all workers.
+   WorkStealingPool pool(job_num);
+   const int cores = std::max( static_cast<int>(std::thread::hardware_concurrency()), 1 );
+   cv::setNumThreads( std::max( cores / pool.getWorkerNum(), 1 ) );
+
+   std::mutex output_lock;
+   StageProfiler profiler;
+   std::vector<int64_t> frame_nums(jobs.size(), 0);
+   std::vector<uchar> succeeded(jobs.size(), 0);
+   const auto start = std::chrono::steady_clock::now();
+   pool.run(
+      jobs.size(),
+      [&](size_t index, int worker_index) {
+         const auto file_start = std::chrono::steady_clock::now();
+
+         // a file that throws is reported and counted as failed, and the batch goes on with the other files.
+         try {
+            cv::VideoCapture capture;
+            cv::VideoWriter writer;
+            if (!openVideos( capture, writer, jobs[index].first, jobs[index].second, codec )) return;
+
+            PatchStabilization stabilizer(config);
+            cv::Mat frame, stabilized;
+            while (capture.read( frame )) {
+               stabilizer.stabilize( stabilized, frame );
+               writer.write( stabilized );
+               frame_nums[index]++;
+            }
+            succeeded[index] = static_cast<uchar>(frame_nums[index] > 0);
+            profiler.merge( stabilizer.getProfiler() );
+         }
+         catch (const std::exception& exception) {
+            std::lock_guard<std::mutex> lock(output_lock);
+            std::cerr << "[worker " << worker_index << "] " << jobs[index].first << " failed after " << frame_nums[index]
+               << " frames: " << exception.what() << "\n";
+            return;
+         }
+
+         const std::chrono::duration<double> file_time = std::chrono::steady_clock::now() - file_start;
+         std::lock_guard<std::mutex> lock(output_lock);
+         std::cout << std::fixed << std::setprecision( 3 )
+            << "[worker " << worker_index << "] " << jobs[index].first << " -> " << jobs[index].second << ": "
+            << frame_nums[index] << " frames in " << file_time.count() << " s, "
+            << static_cast<double>(frame_nums[index]) / std::max( file_time.count(), 1e-9 ) << " fps\n";
+      }
+   );
+   const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+
+   int64_t total_frame_num = 0;
+   size_t succeeded_num = 0;
+   for (size_t i = 0; i < jobs.size(); ++i) {
+      total_frame_num += frame_nums[i];
+      succeeded_num += succeeded[i];
+   }
+   std::cout << std::fixed << std::setprecision( 3 )
+      << "BATCH: " << succeeded_num << "/" << jobs.size() << " files, " << total_frame_num << " frames in "
+      << total_time.count() << " s with " << pool.getWorkerNum() << " workers, "
+      << static_cast<double>(total_frame_num) / std::max( total_time.count(), 1e-9 ) << " fps\n";
+   if (!writeProfile( profiler, profile_path )) return 1;
+   return succeeded_num == jobs.size() ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+   const cv::CommandLineParser parser(argc, argv, Keys);
+   const bool is_batch = parser.has( "batch" );
+   if (parser.has( "help" ) || (!is_batch && (!parser.has( "@input" ) || !parser.has( "@output" )))) {
+      parser.printMessage();
+      return parser.has( "help" ) ? 0 : 1;
+   }
+
+   PatchStabilization::Config config;
+   if (!getConfig( config, parser )) return 1;
+
+   const auto codec = parser.get<std::string>( "codec" );
+   const int pool_size = parser.get<int>( "pool" );
+   const int job_num = parser.get<int>( "jobs" );
+   const int segment_num = parser.get<int>( "segments" );
+   const int overlap_frame_num = parser.get<int>( "overlap" );
+   const auto profile_path = parser.get<std::string>( "profile" );
+   const auto trajectory_path = parser.get<std::string>( "trajectory" );
+   const auto crop_ratio = parser.get<double>( "crop" );
+   if (!parser.check()) {
+      parser.printErrors();
+      return 1;
+   }
+   if (codec.size() != 4) {
+      std::cerr << "the codec must be a fourcc: " << codec << "\n";
+      return 1;
+   }
+
+   if (!profile_path.empty() && (parser.has( "render" ) || parser.has( "offline" ))) {
+      std::cerr << "--profile is not supported with --render or --offline\n";
+      return 1;
+   }
+
+   // the sidecar holds the tracking state of every frame, which only the streaming paths have.
+   if (!trajectory_path.empty() && (is_batch || parser.has( "render" ) || parser.has( "offline" ) || segment_num > 0)) {
+      std::cerr << "--trajectory is not supported with --batch, --render, --offline or --segments\n";
+      return 1;
+   }
+
+   if (is_batch) return stabilizeBatch( parser.get<std::string>( "batch" ), codec, config, job_num, profile_path );
+   if (parser.has( "yuv" )) {
+      return stabilizeYuv(
+         parser.get<std::string>( "@input" ), parser.get<std::string>( "@output" ), config, parser.get<std::string>( "size" ), profile_path,
+         trajectory_path
+      );
+   }
+   if (parser.has( "render" )) {
+      return renderTrajectory(
+         parser.get<std::string>( "@input" ), parser.get<std::string>( "@output" ), codec, config, parser.get<std::string>( "render" ), crop_ratio
+      );
+   }
+   if (parser.has( "offline" )) {
+      return stabilizeOffline( parser.get<std::string>( "@input" ), parser.get<std::string>( "@output" ), codec, config, crop_ratio );
+   }
+   if (segment_num > 0) {
+      return stabilizeSegmented(
+         parser.get<std::string>( "@input" ), parser.get<std::string>( "@output" ), codec, config, segment_num, overlap_frame_num, profile_path
+      );
+   }
+   return stabilizeVideo( parser.get<std::string>( "@input" ), parser.get<std::string>( "@output" ), codec, config, pool_size, profile_path, trajectory_path );
+}
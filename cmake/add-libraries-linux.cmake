@@ -1,2 +1,4 @@
 include_directories("${CMAKE_SOURCE_DIR}/3rd_party/opencv/include")
-link_directories("${CMAKE_SOURCE_DIR}/3rd_party/opencv/lib/linux")
\ No newline at end of file
+link_directories("${CMAKE_SOURCE_DIR}/3rd_party/opencv/lib/linux")
+
+find_package(Threads REQUIRED)
\ No newline at end of file
@@ -0,0 +1 @@
+target_link_libraries(${TARGET_NAME} PRIVATE opencv_highgui)
\ No newline at end of file
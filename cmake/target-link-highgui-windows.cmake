@@ -0,0 +1,5 @@
+if(${CMAKE_BUILD_TYPE} MATCHES Debug)
+	target_link_libraries(${TARGET_NAME} PRIVATE opencv_highguid)
+else()
+	target_link_libraries(${TARGET_NAME} PRIVATE opencv_highgui)
+endif()
\ No newline at end of file
@@ -1,9 +1,10 @@
 target_link_libraries(
-     VideoStabilization
+     ${TARGET_NAME}
+     PUBLIC
         opencv_core
         opencv_imgproc
         opencv_imgcodecs
-        opencv_highgui
         opencv_videoio
         opencv_video
+        Threads::Threads
 )
\ No newline at end of file
@@ -1,31 +1,14 @@
-#include "ProjectPath.h"
-#include "PatchStabilization.h"
-#include <chrono>
-
-void getTestset(std::vector<std::string>& testset)
-{
-   const std::string video_directory_path = std::string(CMAKE_SOURCE_DIR) + "/samples";
-   testset = {
-      video_directory_path + "/test1.avi",
-      video_directory_path + "/test2.avi",
-      video_directory_path + "/test3.avi"
-   };
-}
+#include "StabilizationPipeline.h"
+#include "Testset.h"
 
 #define PAUSE ' '
-int displayStabilizedFrame(const cv::Mat& frame, const cv::Mat& stabilized, bool to_pause, bool screen_merged = false)
+int displayStabilizedFrame(const StabilizationPipeline::Frame& frame, bool to_pause)
 {
-   if (screen_merged) {
-      const cv::Mat result = cv::Mat::zeros(frame.rows, frame.cols * 2, CV_8UC3);
-      const int col_diff_size = (frame.cols - stabilized.cols) / 2;
-      const int row_diff_size = (frame.rows - stabilized.rows) / 2;
-      frame.copyTo( result(cv::Rect(0, 0, frame.cols, frame.rows)) );
-      stabilized.copyTo( result(cv::Rect(frame.cols + col_diff_size, row_diff_size, stabilized.cols, stabilized.rows)) );
-      cv::imshow( "Input | Stabilized", result );
-   }
+   // the pipeline decodes and warps straight into the halves of the canvas, so it is shown as it is.
+   if (!frame.Canvas.empty()) cv::imshow( "Input | Stabilized", frame.Canvas );
    else {
-      cv::imshow( "Input", frame );
-      cv::imshow( "Stabilized", stabilized );
+      cv::imshow( "Input", frame.Input );
+      cv::imshow( "Stabilized", frame.Stabilized );
    }
 
    const int key = cv::waitKey( 1 );
@@ -52,23 +35,20 @@ bool processKeyPressed(bool& to_pause, const int& key_pressed)
    return TO_BE_CONTINUED;
 }
 
-void playVideoAndStabilize(cv::VideoCapture& cam, PatchStabilization& stabilizer)
+void playVideoAndStabilize(cv::VideoCapture& cam, StabilizationPipeline& pipeline)
 {
-   int key_pressed = -1;
+   // decoding, estimation and warping run on their own threads, and the frames are displayed here in order.
    bool to_pause = false;
-   cv::Mat frame, stabilized;
-   while (true) {
-      cam >> frame;
-      if (frame.empty()) break;
-
-      std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
-      stabilizer.stabilize( stabilized, frame );
-      const std::chrono::duration<double> stabilization_process_time = (std::chrono::system_clock::now() - start) * 1000.0;
-      std::cout << "PROCESS TIME: " << stabilization_process_time.count() << " ms... \r";
+   pipeline.run(
+      cam,
+      [&to_pause](const StabilizationPipeline::Frame& frame) {
+         std::cout << "PROCESS TIME: " << frame.EstimationTime << " ms"
+            << " (IRLS ITERATIONS: " << frame.IterationNum << ")... \r";
 
-      key_pressed = displayStabilizedFrame( frame, stabilized, to_pause, true );
-      if (processKeyPressed( to_pause, key_pressed ) == TO_BE_CLOSED) break;
-   }
+         const int key_pressed = displayStabilizedFrame( frame, to_pause );
+         return processKeyPressed( to_pause, key_pressed ) == TO_BE_CONTINUED;
+      }
+   );
 }
 
 void runTestSet(const std::vector<std::string>& testset)
@@ -82,8 +62,8 @@ void runTestSet(const std::vector<std::string>& testset)
       const int height = static_cast<int>(cam.get( cv::CAP_PROP_FRAME_HEIGHT ));
       std::cout << "*** TEST SET(" << width << " x " << height << "): " << test_data.c_str() << "***\n";
 
-      PatchStabilization stabilizer;
-      playVideoAndStabilize( cam, stabilizer );
+      StabilizationPipeline pipeline(PatchStabilization::Config(), 8, true);
+      playVideoAndStabilize( cam, pipeline );
       cam.release();
    }
 }
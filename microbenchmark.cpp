@@ -0,0 +1,211 @@
+#include "PatchStabilization.h"
+#include "PerspectiveWarper.h"
+#include "SyntheticMotion.h"
+#include "Testset.h"
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <memory>
+
+const char* const Keys =
+   "{help h        |      | print this message}"
+   "{warmup        | 3    | number of passes over the frames that are not measured}"
+   "{repetitions   | 10   | number of measured passes over the frames}"
+   "{frames        | 8    | number of synthetic frames per resolution}"
+   "{synthetic     | true | run the synthetic frames at 480p, 720p, 1080p and 4K}"
+   "{samples       | true | run the videos in samples/}"
+   "{tracker       | lk   | tracking engine: lk (pyramidal LK) or ic (inverse compositional)}"
+   "{scale         | 1    | motion estimation scale: 1, 2 or 4}";
+
+// a textured scene seen by a camera with a small rotation and translation per frame.
+void getSyntheticFrames(std::vector<cv::Mat>& frames, const cv::Size& size, int frame_num)
+{
+   cv::RNG rng(0x5EED);
+   const cv::Size scene_size(size.width + size.width / 8, size.height + size.height / 8);
+   cv::Mat scene;
+   SyntheticMotion::createScene( scene, scene_size, 0x5EED );
+
+   frames.resize( frame_num );
+   const cv::Point2f center(static_cast<float>(scene_size.width) * 0.5f, static_cast<float>(scene_size.height) * 0.5f);
+   for (int i = 0; i < frame_num; ++i) {
+      cv::Mat transform = cv::getRotationMatrix2D( center, rng.uniform( -1.0, 1.0 ), 1.0 );
+      transform.at<double>( 0, 2 ) += rng.uniform( -4.0, 4.0 ) - (scene_size.width - size.width) * 0.5;
+      transform.at<double>( 1, 2 ) += rng.uniform( -4.0, 4.0 ) - (scene_size.height - size.height) * 0.5;
+      cv::warpAffine( scene, frames[i], transform, size, cv::INTER_LINEAR, cv::BORDER_REFLECT101 );
+   }
+}
+
+// calls the private stages of PatchStabilization one at a time on prepared inputs, so each one is measured
+// without the others. the tracking stages run against the reference of the first frame with the identity prediction,
+// and the patch table is restored before every call, so every pass measures the same workload.
+class StageBenchmark
+{
+public:
+   StageBenchmark(const PatchStabilization::Config& config, int warmup_num, int repetition_num) :
+      Settings( config ), WarmupNum( warmup_num ), RepetitionNum( repetition_num ) {}
+
+   void run(const std::vector<cv::Mat>& frames) const
+   {
+      std::vector<cv::Mat> gray_frames(frames.size());
+      const cv::Size motion_size(frames[0].cols / Settings.MotionScale, frames[0].rows / Settings.MotionScale);
+      for (size_t i = 0; i < frames.size(); ++i) {
+         cv::cvtColor( frames[i], gray_frames[i], cv::COLOR_BGR2GRAY );
+         if (Settings.MotionScale > 1) cv::resize( gray_frames[i], gray_frames[i], motion_size, 0.0, 0.0, cv::INTER_AREA );
+      }
+
+      PatchStabilization stabilizer(Settings);
+      stabilizer.prepareWorkspace( frames[0].size() );
+      report( "initialize", frames.size(), [&](size_t i) { stabilizer.initialize( gray_frames[i] ); } );
+
+      stabilizer.initialize( gray_frames[0] );
+      const PatchTable initial_patches = stabilizer.Reference.Patches;
+      report(
+         "updatePointsAndReliability", frames.size(),
+         [&](size_t i) { stabilizer.updatePointsAndReliability( gray_frames[i] ); },
+         [&](size_t) { stabilizer.Reference.Patches = initial_patches; }
+      );
+
+      // the IRLS solve starts from the points tracked in each frame, which are prepared once beforehand.
+      std::vector<PatchTable> tracked_patches(frames.size());
+      for (size_t i = 0; i < frames.size(); ++i) {
+         stabilizer.Reference.Patches = initial_patches;
+         stabilizer.updatePointsAndReliability( gray_frames[i] );
+         tracked_patches[i] = stabilizer.Reference.Patches;
+      }
+      cv::Matx<float, 3, 3> updated;
+      report(
+         "solveHomography (IRLS)", frames.size(),
+         [&](size_t) { stabilizer.solveHomography( updated ); },
+         [&](size_t i) {
+            stabilizer.Reference.Patches = tracked_patches[i];
+            stabilizer.IsWarmStarted = false;
+         }
+      );
+
+      const cv::Mat stabilizing_homography = cv::getRotationMatrix2D(
+         cv::Point2f(static_cast<float>(frames[0].cols) * 0.5f, static_cast<float>(frames[0].rows) * 0.5f), 0.5, 1.0
+      );
+      cv::Mat perspective = cv::Mat::eye( 3, 3, CV_64FC1 );
+      stabilizing_homography.copyTo( perspective.rowRange( 0, 2 ) );
+      cv::Mat stabilized;
+      report( "warp", frames.size(), [&](size_t i) { stabilizer.warp( stabilized, frames[i], perspective ); } );
+
+      // the warp kernel alone and the function it replaces, on the whole frame and with some perspective.
+      cv::Matx<float, 3, 3> homography(perspective);
+      homography(2, 0) = 2e-5f;
+      homography(2, 1) = -1e-5f;
+      const cv::Rect frame_region(cv::Point(0, 0), frames[0].size());
+      cv::Mat warped;
+      report(
+         "PerspectiveWarper::warp", frames.size(),
+         [&](size_t i) { PerspectiveWarper::warp( warped, frames[i], homography, frame_region ); }
+      );
+      report(
+         "cv::warpPerspective", frames.size(),
+         [&](size_t i) { cv::warpPerspective( frames[i], warped, cv::Mat(homography), frames[i].size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT ); }
+      );
+
+      // the full path keeps its state across frames, so each pass restarts on a new stabilizer.
+      std::unique_ptr<PatchStabilization> full;
+      report(
+         "stabilize", frames.size(),
+         [&](size_t i) { full->stabilize( stabilized, frames[i] ); },
+         [&](size_t i) { if (i == 0) full = std::make_unique<PatchStabilization>( Settings ); }
+      );
+   }
+
+private:
+   PatchStabilization::Config Settings;
+   int WarmupNum;
+   int RepetitionNum;
+
+   // only the stage is timed. prepare runs before every call, outside of the measurement.
+   void report(
+      const std::string& stage_name,
+      size_t frame_num,
+      const std::function<void(size_t)>& stage,
+      const std::function<void(size_t)>& prepare = nullptr
+   ) const
+   {
+      const auto run_pass = [&]() {
+         std::chrono::duration<double, std::nano> time(0.0);
+         for (size_t i = 0; i < frame_num; ++i) {
+            if (prepare) prepare( i );
+            const auto start = std::chrono::steady_clock::now();
+            stage( i );
+            time += std::chrono::steady_clock::now() - start;
+         }
+         return time.count();
+      };
+      for (int r = 0; r < WarmupNum; ++r) run_pass();
+
+      double total_time = 0.0;
+      for (int r = 0; r < RepetitionNum; ++r) total_time += run_pass();
+
+      const double call_num = static_cast<double>(std::max( RepetitionNum, 1 )) * static_cast<double>(frame_num);
+      const double nanoseconds = total_time / call_num;
+      std::cout << std::fixed << std::setprecision( 1 )
+         << "   " << std::left << std::setw( 30 ) << stage_name
+         << std::right << std::setw( 16 ) << nanoseconds << " ns/frame"
+         << std::setw( 12 ) << 1e9 / nanoseconds << " fps\n";
+   }
+};
+
+int main(int argc, char** argv)
+{
+   const cv::CommandLineParser parser(argc, argv, Keys);
+   if (parser.has( "help" )) {
+      parser.printMessage();
+      return 0;
+   }
+
+   const int warmup_num = std::max( parser.get<int>( "warmup" ), 0 );
+   const int repetition_num = std::max( parser.get<int>( "repetitions" ), 1 );
+   const int frame_num = std::max( parser.get<int>( "frames" ), 2 );
+   const auto tracker = parser.get<std::string>( "tracker" );
+   const int motion_scale = parser.get<int>( "scale" );
+   if (!parser.check()) {
+      parser.printErrors();
+      return 1;
+   }
+
+   PatchStabilization::Config config;
+   config.MotionScale = motion_scale;
+   if (config.MotionScale != 1 && config.MotionScale != 2 && config.MotionScale != 4) {
+      std::cerr << "the motion scale must be 1, 2 or 4: " << config.MotionScale << "\n";
+      return 1;
+   }
+   if (tracker == "ic") config.TrackerType = PatchStabilization::TRACKER_TYPE::INVERSE_COMPOSITIONAL;
+   else if (tracker != "lk") {
+      std::cerr << "unknown tracker: " << tracker << "\n";
+      return 1;
+   }
+   const StageBenchmark benchmark(config, warmup_num, repetition_num);
+
+   std::vector<cv::Mat> frames;
+   if (parser.get<bool>( "synthetic" )) {
+      const std::vector<std::pair<std::string, cv::Size>> resolutions = {
+         { "480p", cv::Size(854, 480) }, { "720p", cv::Size(1280, 720) },
+         { "1080p", cv::Size(1920, 1080) }, { "4K", cv::Size(3840, 2160) }
+      };
+      for (const auto& resolution : resolutions) {
+         getSyntheticFrames( frames, resolution.second, frame_num );
+         std::cout << "*** MICROBENCHMARK(" << resolution.second.width << " x " << resolution.second.height << ", "
+            << frames.size() << " frames): synthetic " << resolution.first << "***\n";
+         benchmark.run( frames );
+      }
+   }
+
+   if (parser.get<bool>( "samples" )) {
+      std::vector<std::string> testset;
+      getTestset( testset );
+      for (const auto& test_data : testset) {
+         if (!readAllFrames( frames, test_data )) continue;
+
+         std::cout << "*** MICROBENCHMARK(" << frames[0].cols << " x " << frames[0].rows << ", " << frames.size() << " frames): "
+            << test_data << "***\n";
+         benchmark.run( frames );
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,478 @@
+#include "ProjectPath.h"
+#include "HarrisPatchSelector.h"
+#include "PatchStabilization.h"
+#include "PerspectiveWarper.h"
+#include "SegmentedStabilization.h"
+#include "SyntheticMotion.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+const char* const Keys =
+   "{help h        |      | print this message}"
+   "{@source       |      | still image or fixed-camera clip to shake (default: a generated scene)}"
+   "{generate      |      | write the shaken video here, and its transforms to <generate>.txt, instead of checking}"
+   "{video         |      | check a previously generated video, whose transforms are in <video>.txt}"
+   "{size          | 640x480 | size of the generated scene}"
+   "{frames        | 120  | number of frames}"
+   "{seed          | 24301 | seed of the trajectory, the noise and the foreground}"
+   "{tracker       | lk   | tracking engine: lk (pyramidal LK) or ic (inverse compositional)}"
+   "{scale         | 1    | motion estimation scale: 1, 2 or 4}"
+   "{codec         | MJPG | fourcc of the generated video}"
+   "{segments      | 0    | estimate in this many time segments, through a video, and check the trajectory at their boundaries}"
+   "{overlap       | 30   | number of frames shared by consecutive segments}"
+   "{harris        |      | check the points of HarrisPatchSelector against the chain of separate filters instead}"
+   "{warp          |      | check PerspectiveWarper against cv::warpPerspective on random homographies instead}"
+   "{speed         |      | also fail when the estimation is slower than min_fps, which depends on the machine}"
+   "{thresholds    |      | yaml file with mean_error, p95_error and min_fps (default: regression_thresholds.yml)}";
+
+struct Thresholds
+{
+   double MeanError;
+   double P95Error;
+   double MinFps;
+   double BoundaryJump;
+};
+
+bool readThresholds(Thresholds& thresholds, const std::string& path)
+{
+   const cv::FileStorage file(path, cv::FileStorage::READ);
+   if (!file.isOpened()) return false;
+
+   file["mean_error"] >> thresholds.MeanError;
+   file["p95_error"] >> thresholds.P95Error;
+   file["min_fps"] >> thresholds.MinFps;
+   file["boundary_jump"] >> thresholds.BoundaryJump;
+   return true;
+}
+
+bool getScenes(std::vector<cv::Mat>& scenes, const std::string& source_path, const cv::Size& size, int frame_num, uint64 seed)
+{
+   scenes.clear();
+   if (source_path.empty()) {
+      scenes.emplace_back();
+      SyntheticMotion::createScene( scenes.back(), size, seed );
+      return true;
+   }
+
+   const cv::Mat image = cv::imread( source_path, cv::IMREAD_COLOR );
+   if (!image.empty()) {
+      scenes.emplace_back( image );
+      return true;
+   }
+
+   cv::VideoCapture capture(source_path);
+   cv::Mat frame;
+   while (static_cast<int>(scenes.size()) < frame_num && capture.read( frame )) scenes.emplace_back( frame.clone() );
+   return !scenes.empty();
+}
+
+bool readVideo(std::vector<cv::Mat>& frames, const std::string& video_path)
+{
+   cv::VideoCapture capture(video_path);
+   if (!capture.isOpened()) return false;
+
+   frames.clear();
+   cv::Mat frame;
+   while (capture.read( frame )) frames.emplace_back( frame.clone() );
+   return !frames.empty();
+}
+
+bool writeVideo(const std::vector<cv::Mat>& frames, const std::string& video_path, const std::string& codec)
+{
+   const int fourcc = cv::VideoWriter::fourcc( codec[0], codec[1], codec[2], codec[3] );
+   cv::VideoWriter writer(video_path, fourcc, 30.0, frames[0].size());
+   if (!writer.isOpened()) return false;
+
+   for (const auto& frame : frames) writer.write( frame );
+   return true;
+}
+
+// SegmentedStabilization reads a video, so frames that do not come from one are written to a temporary one first.
+bool estimateSegmented(
+   std::vector<cv::Matx<double, 3, 3>>& stabilizing_homographies,
+   std::vector<int>& segment_begins,
+   const std::vector<cv::Mat>& frames,
+   const std::string& video_path,
+   const std::string& codec,
+   const PatchStabilization::Config& config,
+   int segment_num,
+   int overlap_frame_num
+)
+{
+   const std::string path = video_path.empty() ? cv::tempfile( ".avi" ) : video_path;
+   if (video_path.empty() && !writeVideo( frames, path, codec )) return false;
+
+   std::vector<cv::Mat> homographies;
+   SegmentedStabilization segmented(config, segment_num, overlap_frame_num);
+   const bool is_estimated = segmented.estimate( homographies, path ) && homographies.size() == frames.size();
+   if (video_path.empty()) std::remove( path.c_str() );
+   if (!is_estimated) return false;
+
+   stabilizing_homographies.clear();
+   for (const auto& homography : homographies) {
+      stabilizing_homographies.emplace_back( cv::Matx<double, 3, 3>(cv::Matx<float, 3, 3>(homography)) );
+   }
+   segment_begins = segmented.getSegmentBegins();
+   return true;
+}
+
+// a wrong boundary transform shifts every frame of the next segment alike, so the mean error of the frames just
+// after a boundary is compared with the one of the frames just before it.
+double getMaxBoundaryJump(const std::vector<double>& frame_errors, const std::vector<int>& segment_begins)
+{
+   static const int window = 5;
+
+   double max_jump = 0.0;
+   for (const auto& begin : segment_begins) {
+      const int before = std::max( begin - window, 1 );
+      const int after = std::min( begin + window, static_cast<int>(frame_errors.size()) );
+      if (begin <= before || after <= begin) continue;
+
+      double before_sum = 0.0, after_sum = 0.0;
+      for (int t = before; t < begin; ++t) before_sum += frame_errors[t];
+      for (int t = begin; t < after; ++t) after_sum += frame_errors[t];
+      max_jump = std::max( max_jump, std::abs( after_sum / (after - begin) - before_sum / (begin - before) ) );
+   }
+   return max_jump;
+}
+
+// the stabilized frame should be the first frame, so a point of the first frame is taken to the t-th frame by the
+// ground truth, and back by the estimate. the error of a frame is the mean distance over a 3x3 grid of points.
+double getError(const cv::Matx<double, 3, 3>& stabilizing, const cv::Matx<double, 3, 3>& to_frame, const cv::Size& size)
+{
+   const cv::Matx<double, 3, 3> round_trip = stabilizing * to_frame;
+   double error = 0.0;
+   for (int j = 1; j <= 3; ++j) {
+      for (int i = 1; i <= 3; ++i) {
+         const cv::Vec3d point(size.width * i * 0.25, size.height * j * 0.25, 1.0);
+         const cv::Vec3d mapped = round_trip * point;
+         error += std::hypot( mapped[0] / mapped[2] - point[0], mapped[1] / mapped[2] - point[1] );
+      }
+   }
+   return error / 9.0;
+}
+
+// a random rotation, scale and translation with perspective. the mild and strong ones differ in its amount, and the
+// horizon ones have so much of it that the horizon of the inverse mapping crosses a 640x480 output.
+cv::Matx<float, 3, 3> getRandomHomography(cv::RNG& rng, int kind)
+{
+   const double perspective_limits[3] = { 2e-4, 1.2e-3, 1e-3 };
+   const double angle = rng.uniform( -0.2, 0.2 );
+   const double scale = rng.uniform( 0.8, 1.25 );
+   cv::Matx<double, 3, 3> homography(
+      scale * std::cos( angle ), -scale * std::sin( angle ), rng.uniform( -40.0, 40.0 ),
+      scale * std::sin( angle ), scale * std::cos( angle ), rng.uniform( -40.0, 40.0 ),
+      rng.uniform( -perspective_limits[kind], perspective_limits[kind] ),
+      rng.uniform( -perspective_limits[kind], perspective_limits[kind] ), 1.0
+   );
+   if (kind == 2) homography(2, 0) = (rng.uniform( 0, 2 ) == 0 ? -1.0 : 1.0) * rng.uniform( 1.6e-3, 3e-3 );
+   return cv::Matx<float, 3, 3>(homography);
+}
+
+// the largest difference between PerspectiveWarper and INTER_LINEAR with BORDER_CONSTANT over the pixels in front of
+// the horizon. behind it, warpPerspective mirrors the frame, and PerspectiveWarper should give the border instead.
+int getWarpDifference(
+   int& behind_num,
+   const cv::Mat& frame,
+   const cv::Matx<float, 3, 3>& homography,
+   const cv::Rect& crop,
+   uchar border_value
+)
+{
+   cv::Mat warped, expected;
+   PerspectiveWarper::warp( warped, frame, homography, crop, border_value );
+   cv::warpPerspective(
+      frame, expected, cv::Mat(homography), frame.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar::all( border_value )
+   );
+
+   const cv::Matx<double, 3, 3> inverse = cv::Matx<double, 3, 3>(homography).inv();
+   const int channel_num = frame.channels();
+   int max_difference = 0;
+   for (int y = 0; y < crop.height; ++y) {
+      const uchar* warped_row = warped.ptr<uchar>( y );
+      const uchar* expected_row = expected.ptr<uchar>( crop.y + y ) + crop.x * channel_num;
+      for (int x = 0; x < crop.width; ++x) {
+         const bool is_behind = inverse(2, 0) * (crop.x + x) + inverse(2, 1) * (crop.y + y) + inverse(2, 2) <= 1e-9;
+         if (is_behind) ++behind_num;
+         for (int c = 0; c < channel_num; ++c) {
+            const int i = x * channel_num + c;
+            const int difference = is_behind ? std::abs( warped_row[i] - border_value ) : std::abs( warped_row[i] - expected_row[i] );
+            max_difference = std::max( max_difference, difference );
+         }
+      }
+   }
+   return max_difference;
+}
+
+bool checkWarper(const cv::Mat& scene, uint64 seed)
+{
+   static const int homography_num = 60;
+   static const char* const kinds[3] = { "mild", "strong", "horizon" };
+
+   cv::Mat gray_scene;
+   cv::cvtColor( scene, gray_scene, cv::COLOR_BGR2GRAY );
+   cv::RNG rng(seed);
+   const cv::Rect full(cv::Point(0, 0), scene.size());
+   const cv::Rect inner(scene.cols / 16, scene.rows / 16, scene.cols * 7 / 8, scene.rows * 7 / 8);
+   int max_differences[3] = { 0, 0, 0 };
+   int behind_num = 0;
+   for (int i = 0; i < homography_num; ++i) {
+      const int kind = i % 3;
+      const cv::Matx<float, 3, 3> homography = getRandomHomography( rng, kind );
+      const cv::Rect& crop = i % 2 == 0 ? full : inner;
+      max_differences[kind] = std::max( {
+         max_differences[kind], getWarpDifference( behind_num, scene, homography, crop, 0 ),
+         getWarpDifference( behind_num, gray_scene, homography, crop, 128 )
+      } );
+   }
+
+   bool is_matched = true;
+   std::cout << "WARP(" << scene.cols << " x " << scene.rows << ", " << homography_num << " homographies, BGR and gray): ";
+   for (int kind = 0; kind < 3; ++kind) {
+      std::cout << (kind > 0 ? ", " : "") << kinds[kind] << " max difference: " << max_differences[kind];
+      is_matched = is_matched && max_differences[kind] <= 1;
+   }
+   std::cout << " (<= 1), pixels behind the horizon: " << behind_num << " -> " << (is_matched ? "PASS" : "FAIL") << "\n";
+   return is_matched;
+}
+
+// the chain that HarrisPatchSelector fuses: the 8-bit blur, the sobel derivatives, their products and the blur of
+// the tensor, followed by the first pixel of the largest trace in every patch.
+void getReferenceHarrisPoints(std::vector<cv::Point>& points, cv::Mat& trace, const cv::Mat& gray, const std::vector<cv::Rect>& patches)
+{
+   cv::Mat blurred, dx, dy;
+   cv::GaussianBlur( gray, blurred, cv::Size(5, 5), 1.0 );
+   blurred.convertTo( blurred, CV_32FC1 );
+   cv::Sobel( blurred, dx, CV_32FC1, 1, 0 );
+   cv::Sobel( blurred, dy, CV_32FC1, 0, 1 );
+
+   cv::Mat ixix, iyiy;
+   cv::multiply( dx, dx, ixix );
+   cv::multiply( dy, dy, iyiy );
+   cv::GaussianBlur( ixix, ixix, cv::Size(5, 5), 2.0 );
+   cv::GaussianBlur( iyiy, iyiy, cv::Size(5, 5), 2.0 );
+   trace = ixix + iyiy;
+
+   points.clear();
+   for (const auto& patch : patches) {
+      cv::Point best = patch.tl();
+      for (int y = patch.y; y < patch.br().y; ++y) {
+         for (int x = patch.x; x < patch.br().x; ++x) {
+            if (trace.at<float>( y, x ) > trace.at<float>( best )) best = cv::Point(x, y);
+         }
+      }
+      points.emplace_back( best );
+   }
+}
+
+// the blur of the image is bit-exact, so the points should be the same. the tensor blur is in float, so the order of
+// the sums may still break an exact tie of traces differently, which is counted apart.
+bool checkHarris(const cv::Mat& scene, const PatchStabilization::Config& config, uint64 seed)
+{
+   static const cv::Size sizes[4] = { cv::Size(0, 0), cv::Size(854, 480), cv::Size(321, 243), cv::Size(1280, 720) };
+
+   const HarrisPatchSelector selector;
+   int patch_num = 0, tie_num = 0, mismatch_num = 0;
+   for (const auto& size : sizes) {
+      cv::Mat gray;
+      if (size.area() == 0) cv::cvtColor( scene, gray, cv::COLOR_BGR2GRAY );
+      else {
+         cv::Mat other_scene;
+         SyntheticMotion::createScene( other_scene, size, seed + static_cast<uint64>(size.width) );
+         cv::cvtColor( other_scene, gray, cv::COLOR_BGR2GRAY );
+      }
+
+      std::vector<cv::Rect> patches;
+      const int patch_width = gray.cols / config.PatchColNum;
+      const int patch_height = gray.rows / config.PatchRowNum;
+      for (int j = 0; j < config.PatchRowNum; ++j) {
+         for (int i = 0; i < config.PatchColNum; ++i) patches.emplace_back( i * patch_width, j * patch_height, patch_width, patch_height );
+      }
+
+      std::vector<HarrisPoint> selected;
+      std::vector<cv::Point> expected;
+      cv::Mat trace;
+      selector.select( selected, gray, patches );
+      getReferenceHarrisPoints( expected, trace, gray, patches );
+      for (size_t i = 0; i < patches.size(); ++i) {
+         patch_num++;
+         const cv::Point point(cvRound( selected[i].Point.x ), cvRound( selected[i].Point.y ));
+         if (point == expected[i]) continue;
+
+         const float expected_trace = trace.at<float>( expected[i] );
+         if (std::abs( trace.at<float>( point ) - expected_trace ) <= 1e-5f * expected_trace) tie_num++;
+         else mismatch_num++;
+      }
+   }
+
+   const bool is_matched = mismatch_num == 0;
+   std::cout << "HARRIS(" << patch_num << " patches of " << config.PatchColNum << " x " << config.PatchRowNum << " grids): "
+      << patch_num - tie_num - mismatch_num << " identical, " << tie_num << " tied traces, " << mismatch_num << " different"
+      << " -> " << (is_matched ? "PASS" : "FAIL") << "\n";
+   return is_matched;
+}
+
+int main(int argc, char** argv)
+{
+   const cv::CommandLineParser parser(argc, argv, Keys);
+   if (parser.has( "help" )) {
+      parser.printMessage();
+      return 0;
+   }
+
+   const auto source_path = parser.get<std::string>( "@source" );
+   const auto generate_path = parser.get<std::string>( "generate" );
+   const auto video_path = parser.get<std::string>( "video" );
+   const auto size_text = parser.get<std::string>( "size" );
+   const auto tracker = parser.get<std::string>( "tracker" );
+   const auto codec = parser.get<std::string>( "codec" );
+   const int motion_scale = parser.get<int>( "scale" );
+   const int segment_num = parser.get<int>( "segments" );
+   const int overlap_frame_num = parser.get<int>( "overlap" );
+   const bool to_check_speed = parser.has( "speed" );
+   const bool to_check_warper = parser.has( "warp" );
+   const bool to_check_harris = parser.has( "harris" );
+   auto thresholds_path = parser.get<std::string>( "thresholds" );
+   SyntheticMotion::Config motion_config;
+   motion_config.FrameNum = parser.get<int>( "frames" );
+   motion_config.Seed = static_cast<uint64>(parser.get<int>( "seed" ));
+   if (!parser.check()) {
+      parser.printErrors();
+      return 1;
+   }
+   if (thresholds_path.empty()) thresholds_path = std::string(CMAKE_SOURCE_DIR) + "/regression_thresholds.yml";
+
+   cv::Size size;
+   char separator = 0;
+   std::istringstream size_stream(size_text);
+   if (!(size_stream >> size.width >> separator >> size.height) || separator != 'x' || size.area() <= 0) {
+      std::cerr << "the size must be <width>x<height>: " << size_text << "\n";
+      return 1;
+   }
+
+   PatchStabilization::Config config;
+   config.MotionScale = motion_scale;
+   if (config.MotionScale != 1 && config.MotionScale != 2 && config.MotionScale != 4) {
+      std::cerr << "the motion scale must be 1, 2 or 4: " << config.MotionScale << "\n";
+      return 1;
+   }
+   if (tracker == "ic") config.TrackerType = PatchStabilization::TRACKER_TYPE::INVERSE_COMPOSITIONAL;
+   else if (tracker != "lk") {
+      std::cerr << "unknown tracker: " << tracker << "\n";
+      return 1;
+   }
+
+   if (to_check_warper || to_check_harris) {
+      std::vector<cv::Mat> scenes;
+      if (!getScenes( scenes, source_path, size, 1, motion_config.Seed )) {
+         std::cerr << "cannot read the source: " << source_path << "\n";
+         return 1;
+      }
+      if (to_check_harris) return checkHarris( scenes[0], config, motion_config.Seed ) ? 0 : 1;
+      return checkWarper( scenes[0], motion_config.Seed ) ? 0 : 1;
+   }
+
+   std::vector<cv::Mat> frames;
+   std::vector<cv::Matx<double, 3, 3>> transforms;
+   if (!video_path.empty()) {
+      if (!readVideo( frames, video_path ) || !SyntheticMotion::readTransforms( transforms, video_path + ".txt" )) {
+         std::cerr << "cannot read the video and its transforms: " << video_path << "\n";
+         return 1;
+      }
+      if (frames.size() != transforms.size()) {
+         std::cerr << "the video has " << frames.size() << " frames but " << transforms.size() << " transforms\n";
+         return 1;
+      }
+   }
+   else {
+      std::vector<cv::Mat> scenes;
+      if (!getScenes( scenes, source_path, size, motion_config.FrameNum, motion_config.Seed )) {
+         std::cerr << "cannot read the source: " << source_path << "\n";
+         return 1;
+      }
+      SyntheticMotion( motion_config ).generate( frames, transforms, scenes );
+   }
+
+   if (!generate_path.empty()) {
+      if (codec.size() != 4 || !writeVideo( frames, generate_path, codec ) ||
+          !SyntheticMotion::writeTransforms( generate_path + ".txt", transforms )) {
+         std::cerr << "cannot write the video and its transforms: " << generate_path << "\n";
+         return 1;
+      }
+      std::cout << frames.size() << " frames -> " << generate_path << " (transforms: " << generate_path << ".txt)\n";
+      return 0;
+   }
+
+   Thresholds thresholds{};
+   if (!readThresholds( thresholds, thresholds_path )) {
+      std::cerr << "cannot read the thresholds: " << thresholds_path << "\n";
+      return 1;
+   }
+
+   if (frames.size() < 2) {
+      std::cerr << "at least two frames are needed\n";
+      return 1;
+   }
+
+   // the first frame is the reference, so the ground truth of the t-th frame relative to it is T_t * T_0^-1.
+   std::vector<cv::Matx<double, 3, 3>> stabilizing_homographies;
+   std::vector<int> segment_begins;
+   std::chrono::duration<double> estimation_time(0.0);
+   if (segment_num > 0) {
+      const auto start = std::chrono::steady_clock::now();
+      if (!estimateSegmented(
+            stabilizing_homographies, segment_begins, frames, video_path, codec, config, segment_num, overlap_frame_num
+          )) {
+         std::cerr << "the segmented estimation failed or missed some frames\n";
+         return 1;
+      }
+      estimation_time = std::chrono::steady_clock::now() - start;
+   }
+   else {
+      PatchStabilization stabilizer(config);
+      cv::Mat stabilizing_homography;
+      for (const auto& frame : frames) {
+         const auto start = std::chrono::steady_clock::now();
+         stabilizer.estimate( stabilizing_homography, frame );
+         estimation_time += std::chrono::steady_clock::now() - start;
+         stabilizing_homographies.emplace_back( cv::Matx<double, 3, 3>(cv::Matx<float, 3, 3>(stabilizing_homography)) );
+      }
+   }
+
+   const cv::Matx<double, 3, 3> from_reference = transforms[0].inv();
+   std::vector<double> frame_errors(frames.size(), 0.0);
+   for (size_t t = 1; t < frames.size(); ++t) {
+      frame_errors[t] = getError( stabilizing_homographies[t], transforms[t] * from_reference, frames[t].size() );
+   }
+   std::vector<double> errors(frame_errors.begin() + 1, frame_errors.end());
+
+   double total = 0.0;
+   for (const auto& error : errors) total += error;
+   const double mean_error = total / static_cast<double>(errors.size());
+   std::sort( errors.begin(), errors.end() );
+   const double p95_error = errors[std::min( errors.size() - 1, errors.size() * 95 / 100 )];
+   const double fps = static_cast<double>(frames.size()) / std::max( estimation_time.count(), 1e-9 );
+
+   // the accuracy and the speed are judged separately, and the speed fails the run only when it was asked for.
+   const double max_boundary_jump = getMaxBoundaryJump( frame_errors, segment_begins );
+   const bool is_accurate =
+      mean_error <= thresholds.MeanError && p95_error <= thresholds.P95Error && max_boundary_jump <= thresholds.BoundaryJump;
+   const bool is_fast = fps >= thresholds.MinFps;
+   std::cout << std::fixed << std::setprecision( 3 )
+      << "REGRESSION(" << frames[0].cols << " x " << frames[0].rows << ", " << frames.size() << " frames, " << tracker << "): "
+      << "mean error: " << mean_error << " px (<= " << thresholds.MeanError << ")"
+      << ", p95 error: " << p95_error << " px (<= " << thresholds.P95Error << ")"
+      << ", max error: " << errors.back() << " px";
+   if (segment_num > 0) {
+      std::cout << ", " << segment_begins.size() << " segments, max boundary jump: " << max_boundary_jump
+         << " px (<= " << thresholds.BoundaryJump << ")";
+   }
+   std::cout
+      << " -> ACCURACY " << (is_accurate ? "PASS" : "FAIL") << "\n"
+      << "   fps: " << fps << " (>= " << thresholds.MinFps << ")"
+      << " -> SPEED " << (is_fast ? "PASS" : "FAIL") << (to_check_speed ? "" : " (not checked without --speed)") << "\n";
+   return is_accurate && (is_fast || !to_check_speed) ? 0 : 1;
+}